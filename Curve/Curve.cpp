@@ -16,220 +16,2095 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cctype>
 #include <cerrno>
+#include <climits>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <locale>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
-#include <VapourSynth.h>
-#include <VSHelper.h>
-
 #ifdef _WIN32
 #ifndef NOMINMAX
 #define NOMINMAX
 #endif
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef CURVE_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#include "Curve.h"
+#include "Expression.h"
+#include "LruCache.h"
+#include "LutStore.h"
+#include "ThreadPool.h"
+
+enum Transfer {
+    transferLinear,
+    transferSrgb,
+    transferBt1886,
+    transferPq,
+    transferHlg,
+    transferSlog3,
+    transferLogc3,
+    transferVlog,
+};
+
+static const char * const transferNames[] = { "linear", "srgb", "bt1886", "pq", "hlg", "slog3", "logc3", "vlog" };
+
+/**
+ * Integer samples that the [0;1] range of the curves covers, which are all of them up to peak in full range.
+ */
+struct Levels {
+    int black;
+    int white;
+    int peak;
+};
+
+/**
+ * Output format of a LUT. Integer samples are rounded to levels and clamped to their peak, while float samples are moved
+ * by offset like the chroma of float clips. Half precision samples are held in uint16_t.
+ */
+struct Quantizer {
+    Levels levels;
+    bool half;
+    float offset;
+};
+
+/**
+ * Curves of all planes compiled into LUTs, along with the kernels that apply them. The DitherMaps point into the LUTs, so
+ * a Grade stays where it is built.
+ */
+struct Grade {
+    bool process[3];
+    std::shared_ptr<const uint16_t> graph[3];
+    std::shared_ptr<const float> floatGraph[3];
+    std::unique_ptr<uint16_t[]> compact[3];
+    std::unique_ptr<CubicSpline> cubic[3];
+    AffineMap affine[3];
+    FloatCurve floatCurve[3];
+    DitherMap ditherMap[3];
+    const void * lut[3];
+    filter_t filter[3];
+    bool fused;
+    int dither;
+
+    // keyframes also keep the curves before quantization, which are blended for the frames in between
+    int lutSize;
+    std::unique_ptr<float[]> ramp[3];
+    Quantizer quantizer[3];
+};
+
+/**
+ * Frames from first to last, both inclusive, that a grade file maps by the same curves.
+ */
+struct GradeRange {
+    int first;
+    int last;
+    std::shared_ptr<const Grade> grade;
+};
+
+/**
+ * Parameters that curves are compiled with, which are fixed when the filter is created.
+ */
+struct Settings {
+    const VSFormat * in;
+    const VSFormat * out;
+    int width;
+    int height;
+    bool listed[3];
+    bool process[3];
+    bool compose;
+    bool fused;
+    int level;
+    int stream;
+    int compact;
+    int engine;
+    int range;
+    int dither;
+    int cache;
+    Transfer transferIn;
+    Transfer transferOut;
+    bool transfers;
+    std::unique_ptr<Expression> expression[3];
+};
+
+static inline int getSample(const Levels & levels, const double x) noexcept {
+    return static_cast<int>(levels.black + x * (levels.white - levels.black) + 0.5);
+}
+
+/**
+ * Limited range places the [0;1] range of the curves on 16-235, or 16-240 for chroma, scaled to the depth, which leaves
+ * the footroom and the headroom to the padding of the curves. Float samples are always full range.
+ */
+static Levels getLevels(const VSFormat * format, const int plane, const int range) noexcept {
+    if (format->sampleType == stFloat)
+        return Levels{};
+
+    const int peak = (1 << format->bitsPerSample) - 1;
+    if (range == 0)
+        return Levels{ 0, peak, peak };
+
+    const int shift = format->bitsPerSample - 8;
+    return Levels{ 16 << shift, (format->colorFamily == cmYUV && plane ? 240 : 235) << shift, peak };
+}
+
+/**
+ * The key points are kept in place as the flat x,y list they are given in, so checking them allocates nothing.
+ */
+static void checkPoints(const std::vector<double> & p, const Levels & levels) {
+    for (size_t i = 0; i < p.size(); i += 2) {
+        if (p[i] < 0.0 || p[i] > 1.0 || p[i + 1] < 0.0 || p[i + 1] > 1.0)
+            throw std::string{ "invalid key point coordinates, x and y must be in the [0;1] range" };
+
+        if (i && getSample(levels, p[i - 2]) >= getSample(levels, p[i]))
+            throw std::string{ "key point coordinates are too close from each other or not strictly increasing on the x-axis" };
+    }
+
+    if (p.size() == 2)
+        throw std::string{ "only one point is defined, this is unlikely to behave as you expect" };
+}
+
+struct segment {
+    int x; // first LUT entry covered
+    double a, b, c, d;
+};
+
+/**
+ * Natural cubic spline interpolation
+ * Finding curves using Cubic Splines notes by Steven Rauch and John Stockie
+ * Returns one cubic per pair of consecutive key points, followed by a constant segment for the right padding.
+ */
+static std::vector<segment> getSegments(const std::vector<double> & points, const Levels & levels) {
+    const int n = static_cast<int>(points.size() / 2); // number of key points
+
+    if (n == 0)
+        return {};
+
+    const double * x = points.data();
+    const double * y = points.data() + 1;
+
+    // the matrix, h and r share one buffer, which stays on the stack up to the 16 points of an acv file
+    constexpr int maxLocalPoints = 16;
+    double local[maxLocalPoints * 5] = {};
+    std::vector<double> heap;
+    if (n > maxLocalPoints)
+        heap.resize(n * 5);
+
+    double * buffer = heap.empty() ? local : heap.data();
+    double (*matrix)[3] = reinterpret_cast<double(*)[3]>(buffer);
+    double * h = buffer + n * 3;
+    double * r = h + n;
+
+    // h(i) = x(i+1) - x(i)
+    for (int i = 0; i < n - 1; i++)
+        h[i] = x[(i + 1) * 2] - x[i * 2];
+
+    // right-side of the polynomials, will be modified to contain the solution
+    for (int i = 1; i < n - 1; i++) {
+        const double yp = y[(i - 1) * 2];
+        const double yc = y[i * 2];
+        const double yn = y[(i + 1) * 2];
+        r[i] = 6 * ((yn - yc) / h[i] - (yc - yp) / h[i - 1]);
+    }
+
+    constexpr int BD = 0; // sub  diagonal (below main)
+    constexpr int MD = 1; // main diagonal (center)
+    constexpr int AD = 2; // sup  diagonal (above main)
+
+    // left side of the polynomials into a tridiagonal matrix
+    matrix[0][MD] = matrix[n - 1][MD] = 1;
+    for (int i = 1; i < n - 1; i++) {
+        matrix[i][BD] = h[i - 1];
+        matrix[i][MD] = 2 * (h[i - 1] + h[i]);
+        matrix[i][AD] = h[i];
+    }
+
+    // tridiagonal solving of the linear system
+    for (int i = 1; i < n; i++) {
+        const double den = matrix[i][MD] - matrix[i][BD] * matrix[i - 1][AD];
+        const double k = den ? 1.0 / den : 1.0;
+        matrix[i][AD] *= k;
+        r[i] = (r[i] - matrix[i][BD] * r[i - 1]) * k;
+    }
+    for (int i = n - 2; i >= 0; i--)
+        r[i] = r[i] - matrix[i][AD] * r[i + 1];
+
+    std::vector<segment> segments;
+    segments.reserve(n);
+
+    // compute the coefficients with x=[x0..xN]
+    for (int i = 0; i < n - 1; i++) {
+        const double yc = y[i * 2];
+        const double yn = y[(i + 1) * 2];
+
+        segment s;
+        s.x = getSample(levels, x[i * 2]);
+        s.a = yc;
+        s.b = (yn - yc) / h[i] - h[i] * r[i] / 2.0 - h[i] * (r[i + 1] - r[i]) / 6.0;
+        s.c = r[i] / 2.0;
+        s.d = (r[i + 1] - r[i]) / (6.0 * h[i]);
+        segments.push_back(s);
+    }
+
+    segments.push_back({ getSample(levels, x[(n - 1) * 2]), y[(n - 1) * 2], 0.0, 0.0, 0.0 });
+
+    return segments;
+}
+
+/**
+ * Curves of one pass, for the r, g and b planes followed by the master curve. Compose chains several of them. The preset
+ * and the acv file are only loaded when the stage is compiled, so that a watched file is read again.
+ */
+struct Stage {
+    std::vector<double> curve[4];
+    std::vector<segment> segments[3];
+    std::vector<segment> master[3];
+    int preset;
+    std::string acv;
+};
+
+/**
+ * Curves of a filter as they are given, which are kept to compile them again when a watched file changes.
+ */
+struct Sources {
+    std::vector<Stage> stages;
+    std::vector<int> keyframes;
+    std::vector<std::string> looks;
+    std::string grades;
+};
+
+/**
+ * Everything that the curves of a filter are compiled into, along with the files they were read from. It is replaced as a
+ * whole when one of them changes, while the frames in flight keep the one they started with.
+ */
+struct Curves {
+    std::shared_ptr<const Grade> grade;
+    std::vector<int> keyframes;
+    std::vector<std::shared_ptr<const Grade>> looks;
+    std::vector<GradeRange> ranges;
+    std::vector<std::string> files;
+
+    // compact=-1 is resolved by timing when the filter is created, and reloads keep the form it chose
+    int compact;
+
+    // blends between keyframes, which are replaced along with the looks they were blended from
+    std::unique_ptr<LruCache<Grade>> blends;
+};
+
+/**
+ * Time of the last modification of a file along with its size, which catches most changes within the resolution of the
+ * time.
+ */
+struct FileStamp {
+    int64_t time;
+    int64_t size;
+};
+
+/**
+ * State of the watch mode, which belongs to whichever thread checks the files.
+ */
+struct Watch {
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point next;
+    std::vector<FileStamp> stamps;
+};
+
+struct CurveData {
+    VSNodeRef * node;
+    const VSVideoInfo * vi;
+    const VSFormat * format;
+    const char * name;
+    Settings settings;
+    Sources sources;
+    std::shared_ptr<const Curves> curves;
+    std::string prop;
+    std::unique_ptr<LruCache<Grade>> cache;
+    std::unique_ptr<Watch> watch;
+    int threads;
+    std::shared_ptr<ThreadPool> pool;
+};
+
+#ifdef _WIN32
+static std::unique_ptr<wchar_t[]> toWide(const char * path) {
+    const int requiredSize = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+    std::unique_ptr<wchar_t[]> wbuffer = std::make_unique<wchar_t[]>(requiredSize);
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wbuffer.get(), requiredSize);
+    return wbuffer;
+}
+#endif
+
+/**
+ * Opens a file for reading, whose path is UTF-8 on Windows as well.
+ */
+static FILE * openFile(const char * path) {
+    FILE * file = nullptr;
+
+#ifdef _WIN32
+    file = _wfopen(toWide(path).get(), L"rb");
+#else
+    file = std::fopen(path, "rb");
+#endif
+    if (!file)
+        throw std::string{ "error opening file " } + path + " (" + std::strerror(errno) + ")";
+
+    return file;
+}
+
+/**
+ * A missing file has a stamp of its own, so that replacing a file by deleting it first counts as a change as well.
+ */
+static FileStamp getFileStamp(const std::string & path) {
+#ifdef _WIN32
+    struct _stat64 status;
+    if (_wstat64(toWide(path.c_str()).get(), &status))
+        return { -1, -1 };
+
+    return { static_cast<int64_t>(status.st_mtime), static_cast<int64_t>(status.st_size) };
+#else
+    struct stat status;
+    if (stat(path.c_str(), &status))
+        return { -1, -1 };
+
+#ifdef __APPLE__
+    const struct timespec & time = status.st_mtimespec;
+#else
+    const struct timespec & time = status.st_mtim;
+#endif
+    return { static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec, static_cast<int64_t>(status.st_size) };
+#endif
+}
+
+/**
+ * Fills the curves that are still empty from a Photoshop curves file, whose first curve is the master one.
+ */
+static void readAcv(const char * acv, std::vector<double> (&curve)[4]) {
+    FILE * acvFile = openFile(acv);
+
+    if (std::fseek(acvFile, 0, SEEK_END)) {
+        std::fclose(acvFile);
+        throw std::string{ "error seeking to the end of file " } + acv + " (" + std::strerror(errno) + ")";
+    }
+
+    long size = std::ftell(acvFile);
+    if (size == -1) {
+        std::fclose(acvFile);
+        throw std::string{ "error determining the size of file " } + acv + " (" + std::strerror(errno) + ")";
+    }
+
+    std::rewind(acvFile);
+
+    std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(size);
+    uint8_t * buf = buffer.get();
+    if (std::fread(buf, 1, size, acvFile) != static_cast<size_t>(size)) {
+        std::fclose(acvFile);
+        throw std::string{ "error reading file " } + acv + " (" + std::strerror(errno) + ")";
+    }
+
+    std::fclose(acvFile);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UNUSED __attribute__((unused))
+#else
+#define UNUSED
+#endif
+
+#define READ16(dst) do {                         \
+    if (size < 2)                                \
+        throw std::string{ "invalid acv file" }; \
+    dst = (buf[0] << 8) | buf[1];                \
+    buf += 2;                                    \
+    size -= 2;                                   \
+} while (0)
+
+    int version UNUSED = 0, numCurves = 0;
+    constexpr int curveIndex[] = { 3, 0, 1, 2 };
+    READ16(version);
+    READ16(numCurves);
+
+    for (int i = 0; i < std::min(numCurves, 4); i++) {
+        int numPoints = 0;
+        READ16(numPoints);
+        std::vector<double> acvCurve;
+        const int j = curveIndex[i];
+
+        for (int n = 0; n < numPoints; n++) {
+            int y = 0, x = 0;
+            READ16(y);
+            READ16(x);
+            acvCurve.push_back(x / 255.0);
+            acvCurve.push_back(y / 255.0);
+        }
+
+        if (curve[j].empty() && !acvCurve.empty())
+            curve[j] = acvCurve;
+    }
+
+#undef UNUSED
+#undef READ16
+}
+
+static void applyPreset(const int preset, std::vector<double> (&curve)[4]) {
+    if (preset < 0 || preset > 10)
+        throw std::string{ "preset must be 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, or 10" };
+
+    if (preset == 1) {
+        if (curve[0].empty())
+            curve[0] = { 0.129,1, 0.466,0.498, 0.725,0 };
+        if (curve[1].empty())
+            curve[1] = { 0.109,1, 0.301,0.498, 0.517,0 };
+        if (curve[2].empty())
+            curve[2] = { 0.098,1, 0.235,0.498, 0.423,0 };
+    } else if (preset == 2) {
+        if (curve[0].empty())
+            curve[0] = { 0,0, 0.25,0.156, 0.501,0.501, 0.686,0.745, 1,1 };
+        if (curve[1].empty())
+            curve[1] = { 0,0, 0.25,0.188, 0.38,0.501, 0.745,0.815, 1,0.815 };
+        if (curve[2].empty())
+            curve[2] = { 0,0, 0.231,0.094, 0.709,0.874, 1,1 };
+    } else if (preset == 3) {
+        if (curve[3].empty())
+            curve[3] = { 0,0, 0.5,0.4, 1,1 };
+    } else if (preset == 4) {
+        if (curve[3].empty())
+            curve[3] = { 0,0, 0.149,0.066, 0.831,0.905, 0.905,0.98, 1,1 };
+    } else if (preset == 5) {
+        if (curve[3].empty())
+            curve[3] = { 0,0, 0.4,0.5, 1,1 };
+    } else if (preset == 6) {
+        if (curve[3].empty())
+            curve[3] = { 0,0, 0.305,0.286, 0.694,0.713, 1,1 };
+    } else if (preset == 7) {
+        if (curve[3].empty())
+            curve[3] = { 0,0, 0.286,0.219, 0.639,0.643, 1,1 };
+    } else if (preset == 8) {
+        if (curve[3].empty())
+            curve[3] = { 0,1, 1,0 };
+    } else if (preset == 9) {
+        if (curve[3].empty())
+            curve[3] = { 0,0, 0.301,0.196, 0.592,0.6, 0.686,0.737, 1,1 };
+    } else if (preset == 10) {
+        if (curve[0].empty())
+            curve[0] = { 0,0.11, 0.42,0.51, 1,0.95 };
+        if (curve[1].empty())
+            curve[1] = { 0,0, 0.5,0.48, 1,1 };
+        if (curve[2].empty())
+            curve[2] = { 0,0.22, 0.49,0.44, 1,0.8 };
+    }
+}
+
+/**
+ * Completes the curves of a stage, where key points that are given directly take priority over the acv file, and the acv
+ * file over the preset.
+ */
+static void loadStage(Stage & stage) {
+    static const char * const names[] = { "r", "g", "b", "master" };
+
+    for (int i = 0; i < 4; i++) {
+        if (stage.curve[i].size() & 1)
+            throw std::string{ "the number of elements in " } + names[i] + " must be a multiple of 2";
+    }
+
+    if (!stage.acv.empty())
+        readAcv(stage.acv.c_str(), stage.curve);
+
+    applyPreset(stage.preset, stage.curve);
+}
+
+static double parseNumber(const std::string & token) {
+    std::istringstream number{ token };
+    number.imbue(std::locale::classic());
+
+    double value;
+    if (!(number >> value) || !number.eof())
+        throw std::string{ "invalid number " } + token;
+    return value;
+}
+
+/**
+ * Parses a stage of Compose, written as key=value pairs separated by spaces with the names of the Curve parameters, e.g.
+ * "preset=4" or "acv=look.acv master=0,0,1,0.9". Key points are separated by commas, and values may be quoted to hold
+ * spaces.
+ */
+static Stage parseStage(const std::string & spec) {
+    static const char * const names[] = { "r", "g", "b", "master" };
+    constexpr const char * space = " \t\r\n";
+    Stage stage = {};
+    std::vector<std::string> keys;
+
+    for (size_t i = spec.find_first_not_of(space); i != std::string::npos; i = spec.find_first_not_of(space, i)) {
+        const size_t end = std::min(spec.find_first_of(space, i), spec.size());
+        const size_t separator = spec.find('=', i);
+        if (separator >= end)
+            throw "expected key=value instead of " + spec.substr(i, end - i);
+
+        const std::string key = spec.substr(i, separator - i);
+        std::string value;
+        i = separator + 1;
+
+        if (i < spec.size() && spec[i] == '"') {
+            const size_t quote = spec.find('"', i + 1);
+            if (quote == std::string::npos)
+                throw "missing closing quote in the value of " + key;
+            value = spec.substr(i + 1, quote - i - 1);
+            i = quote + 1;
+        } else {
+            value = spec.substr(i, end - i);
+            i = end;
+        }
+
+        if (std::find(keys.begin(), keys.end(), key) != keys.end())
+            throw key + " specified twice";
+        keys.push_back(key);
+
+        const auto curve = std::find_if(std::begin(names), std::end(names), [&](const char * name) { return key == name; });
+
+        if (key == "preset") {
+            const double number = parseNumber(value);
+            stage.preset = static_cast<int>(number);
+            if (stage.preset != number)
+                throw std::string{ "preset must be an integer" };
+        } else if (key == "acv") {
+            stage.acv = value;
+        } else if (curve != std::end(names)) {
+            size_t start = 0;
+            for (size_t comma = value.find(','); ; comma = value.find(',', start)) {
+                stage.curve[curve - std::begin(names)].push_back(parseNumber(value.substr(start, comma - start)));
+                if (comma == std::string::npos)
+                    break;
+                start = comma + 1;
+            }
+        } else {
+            throw "unknown key " + key + ", which must be preset, r, g, b, master, or acv";
+        }
+    }
+
+    return stage;
+}
+
+/**
+ * Evaluates the curve at every LUT entry and hands the value to store, which quantizes it. Curves are clipped to [0;1],
+ * while a plane without a curve keeps the samples outside the levels.
+ */
+template<typename F>
+static void interpolate(const std::vector<segment> & segments, const int lutSize, const Levels & levels, F && store) {
+    const double span = levels.white - levels.black;
+
+    if (segments.empty()) {
+        for (int i = 0; i < lutSize; i++)
+            store(i, (i - levels.black) / span);
+        return;
+    }
+
+    // left padding
+    for (int i = 0; i < segments.front().x; i++)
+        store(i, segments.front().a);
+
+    // compute the graph with x=[x0..xN]
+    for (size_t i = 0; i + 1 < segments.size(); i++) {
+        const segment & s = segments[i];
+
+        for (int x = s.x; x <= segments[i + 1].x; x++) {
+            const double xx = (x - s.x) / span;
+            store(x, std::min(std::max(s.a + s.b * xx + s.c * xx * xx + s.d * xx * xx * xx, 0.0), 1.0));
+        }
+    }
+
+    // right padding
+    for (int i = segments.back().x; i < lutSize; i++)
+        store(i, segments.back().a);
+}
+
+static inline void quantize(uint16_t & dst, const double y, const Quantizer & q) noexcept {
+    if (q.half)
+        dst = floatToHalf(static_cast<float>(y) - q.offset);
+    else
+        dst = static_cast<uint16_t>(std::min(std::max(getSample(q.levels, y), 0), q.levels.peak));
+}
+
+static inline void quantize(float & dst, const double y, const Quantizer & q) noexcept {
+    dst = static_cast<float>(y) - q.offset;
+}
+
+/**
+ * Fills the LUT of a plane in the output format. When a master curve follows, the plane curve is rounded to the input
+ * levels first, since the master is looked up by its result.
+ */
+template<typename T>
+static void fillGraph(T * VS_RESTRICT graph, const std::vector<segment> & segments, const std::vector<segment> * master,
+                      const int lutSize, const Levels & levels, const Quantizer & q) {
+    if (!master) {
+        interpolate(segments, lutSize, levels, [&](const int i, const double y) { quantize(graph[i], y, q); });
+        return;
+    }
+
+    const Quantizer input = { levels, false, 0.0f };
+    auto rounded = std::make_unique<uint16_t[]>(lutSize);
+    auto mapped = std::make_unique<T[]>(lutSize);
+    interpolate(segments, lutSize, levels, [&](const int i, const double y) { quantize(rounded[i], y, input); });
+    interpolate(*master, lutSize, levels, [&](const int i, const double y) { quantize(mapped[i], y, q); });
+
+    for (int i = 0; i < lutSize; i++)
+        graph[i] = mapped[rounded[i]];
+}
+
+/**
+ * Decodes a signal in [0;1] to linear light. PQ is relative to 10000 cd/m2, HLG is the inverse OETF, i.e. scene light,
+ * and the camera logs are scaled so that a full signal decodes to 1, which keeps the curves on [0;1].
+ */
+static double toLinear(const Transfer transfer, const double x) noexcept {
+    switch (transfer) {
+    case transferSrgb:
+        return x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4);
+    case transferBt1886:
+        return std::pow(x, 2.4);
+    case transferPq: {
+        constexpr double m1 = 2610.0 / 16384, m2 = 2523.0 / 4096 * 128, c1 = 3424.0 / 4096, c2 = 2413.0 / 4096 * 32, c3 = 2392.0 / 4096 * 32;
+        const double p = std::pow(x, 1.0 / m2);
+        return std::pow(std::max(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+    }
+    case transferHlg: {
+        constexpr double a = 0.17883277, b = 1.0 - 4.0 * a, c = 0.55991072952956;
+        return x <= 0.5 ? x * x / 3.0 : (std::exp((x - c) / a) + b) / 12.0;
+    }
+    case transferSlog3: {
+        const double linear = x >= 171.2102946929 / 1023 ? std::pow(10.0, (x * 1023 - 420) / 261.5) * 0.19 - 0.01 : (x * 1023 - 95) * 0.01125 / (171.2102946929 - 95);
+        return linear / (std::pow(10.0, (1023.0 - 420) / 261.5) * 0.19 - 0.01);
+    }
+    case transferLogc3: {
+        constexpr double cut = 0.010591, a = 5.555556, b = 0.052272, c = 0.247190, d = 0.385537, e = 5.367655, f = 0.092809;
+        const double linear = x > e * cut + f ? (std::pow(10.0, (x - d) / c) - b) / a : (x - f) / e;
+        return linear / ((std::pow(10.0, (1.0 - d) / c) - b) / a);
+    }
+    case transferVlog: {
+        constexpr double b = 0.00873, c = 0.241514, d = 0.598206;
+        const double linear = x < 0.181 ? (x - 0.125) / 5.6 : std::pow(10.0, (x - d) / c) - b;
+        return linear / (std::pow(10.0, (1.0 - d) / c) - b);
+    }
+    default:
+        return x;
+    }
+}
+
+static double fromLinear(const Transfer transfer, const double y) noexcept {
+    switch (transfer) {
+    case transferSrgb:
+        return y <= 0.0031308 ? y * 12.92 : 1.055 * std::pow(y, 1.0 / 2.4) - 0.055;
+    case transferBt1886:
+        return std::pow(y, 1.0 / 2.4);
+    case transferPq: {
+        constexpr double m1 = 2610.0 / 16384, m2 = 2523.0 / 4096 * 128, c1 = 3424.0 / 4096, c2 = 2413.0 / 4096 * 32, c3 = 2392.0 / 4096 * 32;
+        const double p = std::pow(y, m1);
+        return std::pow((c1 + c2 * p) / (1.0 + c3 * p), m2);
+    }
+    case transferHlg: {
+        constexpr double a = 0.17883277, b = 1.0 - 4.0 * a, c = 0.55991072952956;
+        return y <= 1.0 / 12 ? std::sqrt(3.0 * y) : a * std::log(12.0 * y - b) + c;
+    }
+    case transferSlog3: {
+        const double linear = y * (std::pow(10.0, (1023.0 - 420) / 261.5) * 0.19 - 0.01);
+        return linear >= 0.01125 ? (420 + std::log10((linear + 0.01) / 0.19) * 261.5) / 1023 : (linear * (171.2102946929 - 95) / 0.01125 + 95) / 1023;
+    }
+    case transferLogc3: {
+        constexpr double cut = 0.010591, a = 5.555556, b = 0.052272, c = 0.247190, d = 0.385537, e = 5.367655, f = 0.092809;
+        const double linear = y * ((std::pow(10.0, (1.0 - d) / c) - b) / a);
+        return linear > cut ? c * std::log10(a * linear + b) + d : e * linear + f;
+    }
+    case transferVlog: {
+        constexpr double b = 0.00873, c = 0.241514, d = 0.598206;
+        const double linear = y * (std::pow(10.0, (1.0 - d) / c) - b);
+        return linear < 0.01 ? 5.6 * linear + 0.125 : c * std::log10(linear + b) + d;
+    }
+    default:
+        return y;
+    }
+}
+
+/**
+ * Evaluates the curve at a value in [0;1] between the LUT entries, the same way interpolate does at them.
+ */
+static double evaluateSegments(const std::vector<segment> & segments, const Levels & levels, const double x) noexcept {
+    if (segments.empty())
+        return x;
+
+    const double span = levels.white - levels.black;
+    const double position = levels.black + x * span;
+    if (position < segments.front().x)
+        return segments.front().a;
+
+    const auto next = std::upper_bound(segments.begin(), segments.end(), position, [](const double p, const segment & s) { return p < s.x; });
+    const segment & s = *(next - 1);
+    const double xx = (position - s.x) / span;
+    return std::min(std::max(s.a + s.b * xx + s.c * xx * xx + s.d * xx * xx * xx, 0.0), 1.0);
+}
+
+/**
+ * Fills the LUT of a plane whose curves are composed with functions the key points cannot express, or with each other. Every
+ * entry is decoded by the input transfer, mapped by the expression and by the chain of plane and master curves without
+ * rounding in between, and encoded by the output transfer, so the chain stays a single lookup. Samples outside the levels are clipped, since the
+ * transfers and expressions are only defined on [0;1].
+ */
+template<typename T>
+static void fillComposedGraph(T * VS_RESTRICT graph, const std::vector<const std::vector<segment> *> & chain, const int lutSize,
+                              const Levels & levels, const Expression * expression, const Transfer transferIn, const Transfer transferOut,
+                              const Quantizer & q) {
+    const double span = levels.white - levels.black;
+
+    for (int i = 0; i < lutSize; i++) {
+        double y = toLinear(transferIn, std::min(std::max((i - levels.black) / span, 0.0), 1.0));
+        if (expression)
+            y = std::min(std::max((*expression)(y), 0.0), 1.0);
+
+        for (const std::vector<segment> * curve : chain)
+            y = evaluateSegments(*curve, levels, y);
+
+        quantize(graph[i], fromLinear(transferOut, std::min(std::max(y, 0.0), 1.0)), q);
+    }
+}
+
+template<typename T, typename U = T, typename G = uint16_t>
+static void filter_c(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _graph) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const G * graph = static_cast<const G *>(_graph);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++)
+            dstp[x] = static_cast<U>(graph[srcp[x]]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+template<typename T, typename U>
+static void filter_float_c(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _curve) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const FloatCurve * curve = static_cast<const FloatCurve *>(_curve);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++)
+            fromFloat(dstp + x, evaluateFloat<false>(curve, toFloat(srcp[x])));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+enum Dither {
+    ditherNone,
+    ditherOrdered,
+    ditherErrorDiffusion,
+};
+
+/**
+ * Quantizes the values of a plane returned by fetch, which have map->shift bits below the output precision.
+ * Error diffusion is Floyd-Steinberg in a serpentine scan, which has to see the whole plane in one call.
+ */
+template<Dither dither, typename T, typename U, typename F>
+static void ditherPlane(const T * srcp, U * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride,
+                        const DitherMap * map, F && fetch) noexcept {
+    const int shift = map->shift;
+    const int half = 1 << shift >> 1;
+    const int mask = (1 << shift) - 1;
+    const int highest = map->scale << shift;
+
+    // the errors spread to the current and to the next row in sixteenths, with a guard column on either side
+    std::vector<int> errors(dither == ditherErrorDiffusion ? (width + 2) * 2 : 0);
+    int * current = errors.data() + 1;
+    int * next = current + width + 2;
+
+    for (int y = 0; y < height; y++) {
+        if (dither == ditherOrdered) {
+            const uint16_t * threshold = map->threshold[y & 7];
+            for (int x = 0; x < width; x++)
+                dstp[x] = static_cast<U>((fetch(srcp[x]) + threshold[x & 7]) >> shift);
+        } else if (dither == ditherErrorDiffusion) {
+            // the error carried to the right and the sums below the previous two columns stay in registers, and values
+            // are rounded and clamped before the shift, which keeps the dependency chain of the scan short
+            const int step = y & 1 ? -1 : 1;
+            int carry = 0, below = 0, belowNext = 0;
+            int x = y & 1 ? width - 1 : 0;
+
+            for (int i = 0; i < width; i++, x += step) {
+                const int value = fetch(srcp[x]) + ((current[x] + carry + 8) >> 4);
+                const int rounded = std::min(std::max((value + half) & ~mask, 0), highest);
+                const int error = value - rounded;
+                dstp[x] = static_cast<U>(rounded >> shift);
+
+                carry = error * 7;
+                next[x - step] = below + error * 3;
+                below = belowNext + error * 5;
+                belowNext = error;
+            }
+
+            next[x - step] = below;
+            std::swap(current, next);
+        } else {
+            for (int x = 0; x < width; x++)
+                dstp[x] = static_cast<U>((fetch(srcp[x]) + half) >> shift);
+        }
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+template<typename T, typename U, Dither dither>
+static void filter_dither_c(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _map) noexcept {
+    const DitherMap * map = static_cast<const DitherMap *>(_map);
+    const uint16_t * graph = map->graph;
+
+    ditherPlane<dither>(static_cast<const T *>(srcp), static_cast<U *>(dstp), width, height, srcStride, dstStride, map,
+                        [graph](const T x) { return static_cast<int>(graph[x]); });
+}
+
+template<typename T, typename U, Dither dither>
+static void filter_float_dither_c(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _map) noexcept {
+    const DitherMap * map = static_cast<const DitherMap *>(_map);
+    const FloatCurve * curve = map->curve;
+    const float mul = static_cast<float>((map->white - map->black) << map->shift);
+    const float add = static_cast<float>(map->black << map->shift) + 0.5f;
+    const float highest = static_cast<float>(map->scale << map->shift);
+
+    ditherPlane<dither>(static_cast<const T *>(srcp), static_cast<U *>(dstp), width, height, srcStride, dstStride, map, [=](const T x) {
+        const float y = evaluateSpline<false>(&curve->spline[1], evaluateSpline<false>(&curve->spline[0], toFloat(x) + curve->offset)) * mul + add;
+        // written so that NaN ends up at 0
+        return static_cast<int>(y > 0.0f ? std::min(y, highest) : 0.0f);
+    });
+}
+
+template<typename T>
+static void filter_affine_c(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _map) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    T * VS_RESTRICT dstp = static_cast<T *>(_dstp);
+    const AffineMap * map = static_cast<const AffineMap *>(_map);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++)
+            dstp[x] = static_cast<T>(evaluateAffine(map, srcp[x]));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+template<typename T>
+static void filter_invert_c(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _map) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    T * VS_RESTRICT dstp = static_cast<T *>(_dstp);
+    const int scale = static_cast<const AffineMap *>(_map)->hi;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++)
+            dstp[x] = static_cast<T>(scale - srcp[x]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+static FloatSpline getFloatSpline(const std::vector<segment> & segments, const int scale) {
+    FloatSpline spline = {};
+    spline.numSegments = static_cast<int>(segments.size());
+
+    for (const segment & s : segments) {
+        spline.start.push_back(static_cast<float>(static_cast<double>(s.x) / scale));
+        spline.a.push_back(static_cast<float>(s.a));
+        spline.b.push_back(static_cast<float>(s.b));
+        spline.c.push_back(static_cast<float>(s.c));
+        spline.d.push_back(static_cast<float>(s.d));
+    }
+
+    return spline;
+}
+
+static bool isIdentity(const uint16_t * graph, const int lutSize) noexcept {
+    for (int i = 0; i < lutSize; i++) {
+        if (graph[i] != i)
+            return false;
+    }
+    return true;
+}
+
+static bool isInversion(const uint16_t * graph, const int lutSize) noexcept {
+    for (int i = 0; i < lutSize; i++) {
+        if (graph[i] != lutSize - 1 - i)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Finds a clamped affine map that reproduces a LUT exactly. The flat runs at both ends of the table become the clamp.
+ * Since the table is rounded, a small range of slopes around the one through the end points is feasible, and for each
+ * slope the feasible offsets form an interval. How far that interval is from being empty is convex in the slope, so a
+ * ternary search finds a feasible slope when there is one.
+ */
+static bool getAffineMap(const uint16_t * graph, const int lutSize, AffineMap & map) {
+    const int scale = lutSize - 1;
+    int lo = 0;
+    int hi = scale;
+    while (lo < scale && graph[lo + 1] == graph[0])
+        lo++;
+    while (hi > lo && graph[hi - 1] == graph[scale])
+        hi--;
+
+    // curved tables stray far from the line through the end points, which rejects them before the search
+    const double slope = hi > lo ? static_cast<double>(graph[hi] - graph[lo]) / (hi - lo) : 0.0;
+    for (int x = lo; x <= hi; x++) {
+        if (std::abs(graph[x] - graph[lo] - slope * (x - lo)) > 2.0)
+            return false;
+    }
+
+    // keeps every intermediate value below 2^30, so the kernels can use 32-bit integers
+    const int shift = 30 - static_cast<int>(std::log2(lutSize));
+    const int64_t one = int64_t{ 1 } << shift;
+
+    // returns how much the lowest feasible offset exceeds the highest one, so a slope works when this is not positive
+    const auto getOffsets = [&](const int64_t mul, int64_t & low, int64_t & high) {
+        low = INT64_MIN;
+        high = INT64_MAX;
+        for (int x = lo; x <= hi; x++) {
+            low = std::max(low, graph[x] * one - mul * (x - lo));
+            high = std::min(high, (graph[x] + 1) * one - 1 - mul * (x - lo));
+        }
+        return low - high;
+    };
+
+    const int64_t guess = std::llround(slope * one);
+    const int64_t range = hi > lo ? 2 * one / (hi - lo) + 2 : 0;
+    int64_t first = guess - range;
+    int64_t last = guess + range;
+    int64_t low, high;
+
+    while (last - first > 2) {
+        const int64_t m1 = first + (last - first) / 3;
+        const int64_t m2 = last - (last - first) / 3;
+        if (getOffsets(m1, low, high) <= getOffsets(m2, low, high))
+            last = m2;
+        else
+            first = m1;
+    }
+
+    for (int64_t mul = first; mul <= last; mul++) {
+        if (getOffsets(mul, low, high) <= 0) {
+            map.lo = lo;
+            map.hi = hi;
+            map.mul = static_cast<int>(mul);
+            map.add = static_cast<int>(low);
+            map.shift = shift;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef CURVE_X86
+/**
+ * Builds the compact form of a LUT described in Curve.h, or returns nullptr when a step or a correction does not fit.
+ */
+static std::unique_ptr<uint16_t[]> compactGraph(const uint16_t * graph, const int lutSize) {
+    const int blocks = lutSize >> compactShift;
+    auto lut = std::make_unique<uint16_t[]>(2 + blocks * 2 + lutSize / 4 + 2);
+    uint16_t * records = lut.get() + 2;
+    uint8_t * corrections = reinterpret_cast<uint8_t *>(records + blocks * 2);
+    lut[0] = blocks;
+
+    for (int block = 0; block < blocks; block++) {
+        const int start = block << compactShift;
+        const int size = 1 << compactShift;
+        int base = graph[start];
+
+        // the last block has no successor, so its line follows the block itself
+        const int end = std::min(start + size, lutSize - 1);
+        const int step = static_cast<int>(std::lround((graph[end] - base) * static_cast<double>(size) / (end - start)));
+        if (step < INT16_MIN || step > INT16_MAX)
+            return nullptr;
+
+        int residual[1 << compactShift];
+        for (int i = 0; i < size; i++)
+            residual[i] = graph[start + i] - (base + ((step * i + size / 2) >> compactShift));
+
+        const int low = *std::min_element(residual, residual + size);
+        const int high = *std::max_element(residual, residual + size);
+        const int mid = (low + high) >> 1;
+        if (high - mid > 7 || low - mid < -8)
+            return nullptr;
+
+        base += mid;
+        records[block * 2] = static_cast<uint16_t>(base);
+        records[block * 2 + 1] = static_cast<uint16_t>(step);
+
+        for (int i = 0; i < size; i++)
+            corrections[(start + i) >> 1] |= ((residual[i] - mid) & 15) << ((start + i) & 1) * 4;
+    }
+
+    return lut;
+}
+
+/**
+ * Converts the segments of a curve to the form used by the direct evaluation kernels, or returns nullptr when there are
+ * too many of them. A curve without key points is the identity, which becomes a single straight segment.
+ */
+static std::unique_ptr<CubicSpline> getCubicSpline(const std::vector<segment> & segments, const int scale) {
+    const std::vector<segment> identity = { { 0, 0.0, 1.0, 0.0, 0.0 }, { scale, 1.0, 0.0, 0.0, 0.0 } };
+    const std::vector<segment> & s = segments.empty() ? identity : segments;
+
+    if (s.size() > CubicSpline::maxSegments)
+        return nullptr;
+
+    auto spline = std::make_unique<CubicSpline>();
+    spline->numSegments = static_cast<int>(s.size());
+    spline->scale = scale;
+
+    for (size_t k = 0; k < s.size(); k++) {
+        spline->knot[k] = s[k].x;
+        spline->start[k] = s[k].x;
+        spline->a[k] = s[k].a;
+        spline->b[k] = s[k].b;
+        spline->c[k] = s[k].c;
+        spline->d[k] = s[k].d;
+    }
+
+    return spline;
+}
+
+/**
+ * Runs a direct evaluation kernel over every input value and checks that it reproduces the LUT. The spline is evaluated
+ * in Horner form with FMA while the LUT is filled term by term, so a value lying right on a rounding boundary could differ.
+ */
+static bool matchesGraph(const filter_t filter, const CubicSpline * spline, const uint16_t * graph, const int lutSize) {
+    auto src = std::make_unique<uint16_t[]>(lutSize);
+    auto dst = std::make_unique<uint16_t[]>(lutSize);
+
+    for (int i = 0; i < lutSize; i++)
+        src[i] = i;
+
+    filter(src.get(), dst.get(), lutSize, 1, lutSize, lutSize, spline);
+    return std::equal(dst.get(), dst.get() + lutSize, graph);
+}
+
+/**
+ * Times both kernels on pseudo-random samples, which spread the lookups over the whole table like grain or fine detail does.
+ * The result depends on the code path, stream and the bit depth but not on the curve, so a ramp is timed once per process
+ * for each of them, which keeps creating filters cheap and gives every filter of a script the same answer.
+ */
+static bool isCompactFaster(const int level, const bool stream, const filter_t flat, const filter_t compact, const int scale) {
+    constexpr int width = 1024;
+    constexpr int height = 64;
+
+    // held while timing, so that filters created at the same time do not measure each other
+    static std::mutex mutex;
+    static std::map<std::tuple<int, bool, int>, bool> decisions;
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    const auto known = decisions.find(std::make_tuple(level, stream, scale));
+    if (known != decisions.end())
+        return known->second;
+
+    auto graph = std::make_unique<uint16_t[]>(scale + 2);
+    for (int i = 0; i <= scale; i++)
+        graph[i] = i;
+    const std::unique_ptr<uint16_t[]> lut = compactGraph(graph.get(), scale + 1);
+
+    auto src = std::make_unique<uint16_t[]>(width * height);
+    auto dst = std::make_unique<uint16_t[]>(width * height);
+
+    std::minstd_rand rng;
+    for (int i = 0; i < width * height; i++)
+        src[i] = rng() & scale;
+
+    const auto measure = [&](const filter_t filter, const uint16_t * table) {
+        const auto start = std::chrono::steady_clock::now();
+        filter(src.get(), dst.get(), width, height, width, width, table);
+        return std::chrono::steady_clock::now() - start;
+    };
+
+    // interleave the runs and keep the best of each, so that a descheduled run does not decide
+    auto flatTime = std::chrono::steady_clock::duration::max();
+    auto compactTime = flatTime;
+    for (int i = 0; i < 5; i++) {
+        flatTime = std::min(flatTime, measure(flat, graph.get()));
+        compactTime = std::min(compactTime, measure(compact, lut.get()));
+    }
+
+    return decisions[std::make_tuple(level, stream, scale)] = compactTime < flatTime;
+}
+
+static void cpuid(int info[4], const int leaf, const int subleaf) noexcept {
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static uint64_t xgetbv(const unsigned index) noexcept {
+#ifdef _MSC_VER
+    return _xgetbv(index);
+#else
+    unsigned eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+/**
+ * Returns 3 for AVX-512 VBMI, 2 for AVX-512 (F, BW, DQ and VL), 1 for AVX2 (with FMA and F16C) and 0 otherwise.
+ * The OS must also have enabled the corresponding register state.
+ */
+static int getSimdLevel() noexcept {
+    int info[4];
+
+    cpuid(info, 0, 0);
+    const int maxLeaf = info[0];
+
+    cpuid(info, 1, 0);
+    const unsigned ecx = info[2];
+    const bool fma = ecx & (1u << 12);
+    const bool osxsave = ecx & (1u << 27);
+    const bool avx = ecx & (1u << 28);
+    const bool f16c = ecx & (1u << 29);
+    if (maxLeaf < 7 || !osxsave || !avx || !fma || !f16c)
+        return 0;
+
+    const uint64_t xcr0 = xgetbv(0);
+    if ((xcr0 & 0x06) != 0x06)
+        return 0;
+
+    cpuid(info, 7, 0);
+    const unsigned ebx = info[1];
+    const unsigned ecx7 = info[2];
+    const bool avx2 = ebx & (1u << 5);
+    const bool avx512 = (ebx & (1u << 16)) && (ebx & (1u << 17)) && (ebx & (1u << 30)) && (ebx & (1u << 31));
+    const bool vbmi = ecx7 & (1u << 1);
+    if (!avx2)
+        return 0;
+
+    if (!avx512 || (xcr0 & 0xE0) != 0xE0)
+        return 1;
+
+    return vbmi ? 3 : 2;
+}
+#endif
+
+template<typename T, typename U>
+static filter_t getFloatFilter(const int level, const bool stream) noexcept {
+    filter_t filter = filter_float_c<T, U>;
+
+#ifdef CURVE_X86
+    if (level >= 2)
+        filter = stream ? filter_float_avx512<T, U, true> : filter_float_avx512<T, U, false>;
+    else if (level == 1)
+        filter = stream ? filter_float_avx2<T, U, true> : filter_float_avx2<T, U, false>;
+#endif
+
+    return filter;
+}
+
+/**
+ * Kernels for integer input whose output differs in size. A float output is looked up from a float LUT.
+ */
+template<typename T, typename U>
+static filter_t getConvertFilter(const int level, const bool stream) noexcept {
+    filter_t filter = filter_c<T, U, typename std::conditional<std::is_same<U, float>::value, float, uint16_t>::type>;
+
+#ifdef CURVE_X86
+    // gathers dominate, so an AVX-512 version would not gain anything
+    if (level >= 1)
+        filter = stream ? filter_convert_avx2<T, U, true> : filter_convert_avx2<T, U, false>;
+#endif
+
+    return filter;
+}
+
+/**
+ * Kernels for dithered integer output. Error diffusion is serial along each row, so only ordered dithering is vectorized,
+ * and float input is handled by the C kernels.
+ */
+template<typename T, typename U>
+static filter_t getDitherFilter(const int dither, const int level, const bool stream) noexcept {
+    filter_t filter = dither == ditherOrdered ? filter_dither_c<T, U, ditherOrdered> : filter_dither_c<T, U, ditherErrorDiffusion>;
+
+#ifdef CURVE_X86
+    if (dither == ditherOrdered && level >= 1)
+        filter = stream ? filter_dither_avx2<T, U, true> : filter_dither_avx2<T, U, false>;
+#endif
+
+    return filter;
+}
+
+template<typename T, typename U>
+static filter_t getFloatDitherFilter(const int dither) noexcept {
+    if (dither == ditherOrdered)
+        return filter_float_dither_c<T, U, ditherOrdered>;
+    else if (dither == ditherErrorDiffusion)
+        return filter_float_dither_c<T, U, ditherErrorDiffusion>;
+    return filter_float_dither_c<T, U, ditherNone>;
+}
+
+/**
+ * Spreads the 8x8 Bayer matrix evenly over the 2^shift values that the dither drops.
+ */
+static void setThresholds(DitherMap & map) noexcept {
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            int bayer = 0;
+            for (int bit = 0; bit < 3; bit++)
+                bayer = bayer << 2 | ((x >> bit ^ y >> bit) & 1) << 1 | (y >> bit & 1);
+
+            map.threshold[y][x] = map.threshold[y][x + 8] = static_cast<uint16_t>((bayer * 2 + 1) << map.shift >> 7);
+        }
+    }
+}
+
+/**
+ * Bands hold about bandSize bytes of source rows. With several threads they are also capped so that every thread
+ * gets a few of them, which keeps the split balanced on small frames.
+ */
+static int getBandHeight(const int height, const int rowSize, const int threads) noexcept {
+    constexpr int bandSize = 256 * 1024;
+
+    int bandHeight = bandSize / rowSize;
+    if (threads > 1)
+        bandHeight = std::min(bandHeight, (height + threads * 4 - 1) / (threads * 4));
+
+    return std::max(bandHeight, 1);
+}
+
+/**
+ * Compiles the curves of the stages into the LUTs of the processed planes and picks the kernels that apply them. Compact
+ * overrides the setting of the same name, since timing the compact form against the flat one with -1 is left to the curves
+ * given when the filter is created, so that per-frame curves stay cheap. The LUTs of keyframes are looked up as they are,
+ * without the other forms of the curves, so that they can be blended.
+ */
+static std::shared_ptr<Grade> compileGrade(const Settings & s, std::vector<Stage> stages, const int compact, const bool keyframe = false) {
+    auto g = std::make_shared<Grade>();
+    const bool isFloat = s.in->sampleType == stFloat;
+    const bool convert = s.in->id != s.out->id;
+    int stream = s.stream;
+
+    const bool composed = s.compose || stages.size() > 1;
+
+    if (isFloat && stages.size() > 1)
+        throw std::string{ "float input only supports a single stage" };
+
+    const auto prefix = [&](const size_t i, const std::string & error) {
+        return composed ? "stage " + std::to_string(i) + ": " + error : error;
+    };
+
+    for (size_t i = 0; i < stages.size(); i++) {
+        try {
+            loadStage(stages[i]);
+        } catch (const std::string & error) {
+            throw prefix(i, error);
+        }
+    }
+
+    // converting the format writes every plane, and the planes that are not listed only have their values converted
+    for (int plane = 0; plane < 3; plane++) {
+        g->process[plane] = s.process[plane];
+        if (convert && !s.listed[plane]) {
+            for (Stage & stage : stages)
+                stage.curve[plane].clear();
+        }
+    }
+
+    const int lutSize = isFloat ? 0 : 1 << s.in->bitsPerSample;
+    const int scale = isFloat ? 65535 : lutSize - 1;
+
+    Levels levels[3];
+    for (int plane = 0; plane < 3; plane++)
+        levels[plane] = isFloat ? Levels{ 0, scale, scale } : getLevels(s.in, plane, s.range);
+
+    // the master curve applies to every plane, so its key points are checked on the narrower levels of luma
+    for (size_t i = 0; i < stages.size(); i++) {
+        Stage & stage = stages[i];
+
+        try {
+            for (int j = 0; j < 4; j++)
+                checkPoints(stage.curve[j], levels[j < 3 ? j : 0]);
+
+            for (int plane = 0; plane < 3; plane++) {
+                if (g->process[plane]) {
+                    stage.segments[plane] = getSegments(stage.curve[plane], levels[plane]);
+                    stage.master[plane] = getSegments(stage.curve[3], levels[plane]);
+                }
+            }
+        } catch (const std::string & error) {
+            throw prefix(i, error);
+        }
+    }
+
+    // a single stage of Curve is rounded between its plane and master curves like it always was, while the stages of
+    // Compose, and several stages given to Curve by a frame property, are composed
+    const Stage & first = stages.front();
+
+    // integer output below 16 bits is dithered from 16 bits of precision, while float input is always quantized by
+    // the dither kernels
+    const bool integerOutput = s.out->sampleType == stInteger;
+    const int ditherShift = integerOutput ? 16 - s.out->bitsPerSample : 0;
+    const bool dithered = integerOutput && (isFloat || (s.dither != ditherNone && ditherShift > 0));
+
+    // the transfers apply to RGB and to luma, and not to planes they would leave unchanged
+    const auto hasTransfers = [&](const int plane) {
+        return s.transfers && !(s.in->colorFamily == cmYUV && plane);
+    };
+
+    // the curves that a plane passes through in order, leaving out the empty ones
+    const auto getChain = [&](const int plane) {
+        std::vector<const std::vector<segment> *> chain;
+        for (const Stage & stage : stages) {
+            if (!stage.segments[plane].empty())
+                chain.push_back(&stage.segments[plane]);
+            if (!stage.master[plane].empty() && s.listed[plane])
+                chain.push_back(&stage.master[plane]);
+        }
+        return chain;
+    };
+
+    const auto isComposed = [&](const int plane) {
+        const bool curves = !getChain(plane).empty();
+        return composed || s.expression[plane] || (hasTransfers(plane) && (s.transferIn != s.transferOut || curves));
+    };
+
+    const auto getQuantizer = [&](const int plane, const int shift) {
+        const Levels out = getLevels(s.out, plane, s.range);
+        return Quantizer{
+            { out.black << shift, out.white << shift, out.peak << shift },
+            s.out->sampleType == stFloat && s.out->bitsPerSample == 16,
+            s.out->colorFamily == cmYUV && plane ? 0.5f : 0.0f
+        };
+    };
+
+    const auto fillPlane = [&](auto * graph, const int plane, const Quantizer & q) {
+        const std::vector<segment> * master = !first.master[plane].empty() && s.listed[plane] ? &first.master[plane] : nullptr;
+
+        if (isComposed(plane))
+            fillComposedGraph(graph, getChain(plane), lutSize, levels[plane], s.expression[plane].get(),
+                              hasTransfers(plane) ? s.transferIn : transferLinear, hasTransfers(plane) ? s.transferOut : transferLinear, q);
+        else
+            fillGraph(graph, first.segments[plane], master, lutSize, levels[plane], q);
+    };
+
+    // luma and chroma differ in their levels, offset and transfers, while the planes of RGB and the two chroma planes
+    // only differ in their curves
+    const auto isSameCurve = [&](const int a, const int b) {
+        if ((s.in->colorFamily == cmYUV && !a != !b) || s.listed[a] != s.listed[b] || s.expression[a] || s.expression[b])
+            return false;
+
+        for (const Stage & stage : stages) {
+            if (stage.curve[a] != stage.curve[b])
+                return false;
+        }
+        return true;
+    };
+
+    // a plane with the same curve as one filled before it takes its LUT, e.g. when only the master curve is given
+    const auto fill = [&](const int plane, const int shift) {
+        for (int other = 0; other < plane; other++) {
+            if (g->process[other] && isSameCurve(other, plane)) {
+                g->graph[plane] = g->graph[other];
+                g->floatGraph[plane] = g->floatGraph[other];
+                return;
+            }
+        }
+
+        if (s.out->sampleType == stFloat && s.out->bitsPerSample == 32) {
+            auto graph = std::make_unique<float[]>(lutSize);
+            fillPlane(graph.get(), plane, getQuantizer(plane, shift));
+            g->floatGraph[plane] = LutStore<float>::intern(std::move(graph), lutSize);
+        } else {
+            auto graph = std::make_unique<uint16_t[]>(lutSize + 1);
+            fillPlane(graph.get(), plane, getQuantizer(plane, shift));
+            g->graph[plane] = LutStore<uint16_t>::intern(std::move(graph), lutSize + 1);
+        }
+    };
+
+    if (!isFloat) {
+        for (int plane = 0; plane < s.in->numPlanes; plane++) {
+            if (g->process[plane])
+                fill(plane, 0);
+        }
+    }
+
+    // planes left unchanged by the curves are passed through like unprocessed ones, and straight lines are computed,
+    // except at 8-bit with avx512vbmi where the table held in registers beats the multiply
+    const bool lookupBeatsAffine = s.in->bytesPerSample == 1 && s.level == 3;
+    bool general[3] = {};
+    for (int plane = 0; plane < s.in->numPlanes; plane++) {
+        if (g->process[plane] && isFloat) {
+            FloatCurve & floatCurve = g->floatCurve[plane];
+            floatCurve.spline[0] = getFloatSpline(first.segments[plane], scale);
+            floatCurve.spline[1] = getFloatSpline(s.listed[plane] ? first.master[plane] : std::vector<segment>{}, scale);
+            floatCurve.offset = s.in->colorFamily == cmYUV && plane ? 0.5f : 0.0f;
+
+            g->process[plane] = convert || floatCurve.spline[0].numSegments || floatCurve.spline[1].numSegments;
+            general[plane] = g->process[plane];
+        } else if (g->process[plane] && (convert || keyframe)) {
+            general[plane] = true;
+        } else if (g->process[plane]) {
+            const uint16_t * graph = g->graph[plane].get();
+
+            // the LUTs are stored once, so a plane holding the LUT of an earlier one is classified like it
+            int other = 0;
+            while (other < plane && g->graph[other].get() != graph)
+                other++;
+
+            if (other < plane) {
+                g->process[plane] = g->process[other];
+                g->affine[plane] = g->affine[other];
+                general[plane] = general[other];
+            } else if (isIdentity(graph, lutSize))
+                g->process[plane] = false;
+            else if (isInversion(graph, lutSize))
+                g->affine[plane] = { 0, scale, -1, scale, 0 };
+            else
+                general[plane] = lookupBeatsAffine || dithered || !getAffineMap(graph, lutSize, g->affine[plane]);
+        }
+    }
+
+    // fusing only applies when more than one plane is processed and all of them have the same dimensions
+    const bool chromaProcessed = g->process[1] || g->process[2];
+    const bool subsampled = s.in->subSamplingW || s.in->subSamplingH;
+    g->fused = s.fused && (g->process[0] ? chromaProcessed && !subsampled : g->process[1] && g->process[2]);
+    g->dither = dithered ? s.dither : ditherNone;
+
+    // auto mode streams once the written planes no longer fit in a typical last-level cache
+    if (stream == -1) {
+        constexpr int64_t streamThreshold = 16 * 1024 * 1024;
+        int64_t frameSize = 0;
+
+        for (int plane = 0; plane < s.in->numPlanes; plane++) {
+            if (g->process[plane]) {
+                const int shift = plane ? s.in->subSamplingW + s.in->subSamplingH : 0;
+                frameSize += (static_cast<int64_t>(s.width) * s.height >> shift) * s.out->bytesPerSample;
+            }
+        }
+
+        stream = frameSize >= streamThreshold;
+    }
+
+    filter_t lookup, affine = nullptr, invert = nullptr;
+    const int inBytes = s.in->bytesPerSample;
+    const int outBytes = s.out->bytesPerSample;
+
+    if (dithered && isFloat) {
+        if (inBytes == 2)
+            lookup = outBytes == 1 ? getFloatDitherFilter<uint16_t, uint8_t>(s.dither) : getFloatDitherFilter<uint16_t, uint16_t>(s.dither);
+        else
+            lookup = outBytes == 1 ? getFloatDitherFilter<float, uint8_t>(s.dither) : getFloatDitherFilter<float, uint16_t>(s.dither);
+    } else if (isFloat) {
+        if (inBytes == 2)
+            lookup = outBytes == 2 ? getFloatFilter<uint16_t, uint16_t>(s.level, stream) : getFloatFilter<uint16_t, float>(s.level, stream);
+        else
+            lookup = outBytes == 2 ? getFloatFilter<float, uint16_t>(s.level, stream) : getFloatFilter<float, float>(s.level, stream);
+    } else if (inBytes != outBytes) {
+        if (inBytes == 1)
+            lookup = outBytes == 2 ? getConvertFilter<uint8_t, uint16_t>(s.level, stream) : getConvertFilter<uint8_t, float>(s.level, stream);
+        else
+            lookup = outBytes == 1 ? getConvertFilter<uint16_t, uint8_t>(s.level, stream) : getConvertFilter<uint16_t, float>(s.level, stream);
+    } else if (s.in->bytesPerSample == 1) {
+        lookup = filter_c<uint8_t>;
+        affine = filter_affine_c<uint8_t>;
+        invert = filter_invert_c<uint8_t>;
+
+#ifdef CURVE_X86
+        if (s.level == 3)
+            lookup = stream ? filter_avx512vbmi<uint8_t, true> : filter_avx512vbmi<uint8_t, false>;
+        else if (s.level == 2)
+            lookup = stream ? filter_avx512<uint8_t, true> : filter_avx512<uint8_t, false>;
+        else if (s.level == 1)
+            lookup = stream ? filter_avx2<uint8_t, true> : filter_avx2<uint8_t, false>;
+
+        // the arithmetic kernels are bound by memory bandwidth, so AVX-512 versions would not gain anything
+        if (s.level >= 1) {
+            affine = stream ? filter_affine_avx2<uint8_t, true> : filter_affine_avx2<uint8_t, false>;
+            invert = stream ? filter_invert_avx2<uint8_t, true> : filter_invert_avx2<uint8_t, false>;
+        }
 #endif
-#include <windows.h>
+    } else {
+        lookup = filter_c<uint16_t>;
+        affine = filter_affine_c<uint16_t>;
+        invert = filter_invert_c<uint16_t>;
+
+#ifdef CURVE_X86
+        if (s.level >= 2)
+            lookup = stream ? filter_avx512<uint16_t, true> : filter_avx512<uint16_t, false>;
+        else if (s.level == 1)
+            lookup = stream ? filter_avx2<uint16_t, true> : filter_avx2<uint16_t, false>;
+
+        if (s.level >= 1) {
+            affine = stream ? filter_affine_avx2<uint16_t, true> : filter_affine_avx2<uint16_t, false>;
+            invert = stream ? filter_invert_avx2<uint16_t, true> : filter_invert_avx2<uint16_t, false>;
+        }
 #endif
+    }
 
-struct CurveData {
-    VSNodeRef * node;
-    const VSVideoInfo * vi;
-    bool process[3];
-    std::unique_ptr<uint16_t[]> graph[4];
-};
+    // dithering only replaces the lookup, since inversions stay exact
+    if (dithered && !isFloat) {
+        if (inBytes == 1)
+            lookup = outBytes == 1 ? getDitherFilter<uint8_t, uint8_t>(s.dither, s.level, stream) : getDitherFilter<uint8_t, uint16_t>(s.dither, s.level, stream);
+        else
+            lookup = outBytes == 1 ? getDitherFilter<uint16_t, uint8_t>(s.dither, s.level, stream) : getDitherFilter<uint16_t, uint16_t>(s.dither, s.level, stream);
+    }
 
-struct keypoint {
-    double x, y;
-    std::shared_ptr<keypoint> next;
-};
+    for (int plane = 0; plane < s.in->numPlanes; plane++) {
+        if (general[plane]) {
+            g->filter[plane] = lookup;
+            if (dithered) {
+                DitherMap & map = g->ditherMap[plane];
+                const Levels out = getLevels(s.out, plane, s.range);
+                map.scale = out.peak;
+                map.shift = s.dither != ditherNone ? ditherShift : 0;
+                map.black = out.black;
+                map.white = out.white;
+                setThresholds(map);
+
+                if (isFloat) {
+                    map.curve = &g->floatCurve[plane];
+                } else {
+                    fill(plane, map.shift);
+                    map.graph = g->graph[plane].get();
+                }
 
-static void parsePoints(const std::vector<double> & p, std::shared_ptr<keypoint> & points, const int scale) {
-    std::shared_ptr<keypoint> last;
+                g->lut[plane] = &map;
+            } else if (isFloat)
+                g->lut[plane] = &g->floatCurve[plane];
+            else if (g->floatGraph[plane])
+                g->lut[plane] = g->floatGraph[plane].get();
+            else
+                g->lut[plane] = g->graph[plane].get();
+        } else {
+            g->filter[plane] = g->affine[plane].mul == -1 && g->affine[plane].shift == 0 ? invert : affine;
+            g->lut[plane] = &g->affine[plane];
+        }
+    }
 
-    // construct a linked list based on the key points
-    for (size_t i = 0; i < p.size(); i += 2) {
-        std::shared_ptr<keypoint> point = std::make_shared<keypoint>();
-        point->x = p[i + 0];
-        point->y = p[i + 1];
+    // a float LUT filled without quantizing holds the curve itself, in [0;1] outside of the padding
+    if (keyframe) {
+        g->lutSize = lutSize;
+        for (int plane = 0; plane < s.in->numPlanes; plane++) {
+            if (general[plane]) {
+                g->ramp[plane] = std::make_unique<float[]>(lutSize);
+                fillPlane(g->ramp[plane].get(), plane, Quantizer{ {}, false, 0.0f });
+                g->quantizer[plane] = getQuantizer(plane, dithered ? g->ditherMap[plane].shift : 0);
+            }
+        }
+        return g;
+    }
 
-        if (point->x < 0.0 || point->x > 1.0 || point->y < 0.0 || point->y > 1.0)
-            throw std::string{ "invalid key point coordinates, x and y must be in the [0;1] range" };
+    const bool anyGeneral = general[0] || general[1] || general[2];
 
-        if (!points)
-            points = point;
+#ifdef CURVE_X86
+    // direct evaluation needs the plain full range spline of every plane that is looked up, so a master curve rules it out
+    bool cubic = false;
+    if (s.engine == 1 && !isFloat && !convert && !dithered && s.range == 0 && !s.transfers && !s.expression[0] && !s.expression[1] && !s.expression[2] && s.in->bytesPerSample == 2 && s.level >= 1 && first.curve[3].empty() && anyGeneral) {
+        const filter_t filter = s.level >= 2 ? filter_cubic_avx512<false> : filter_cubic_avx2<false>;
+        cubic = true;
 
-        if (last) {
-            if (static_cast<int>(last->x * scale + 0.5) >= static_cast<int>(point->x * scale + 0.5))
-                throw std::string{ "key point coordinates are too close from each other or not strictly increasing on the x-axis" };
-            last->next = point;
+        for (int plane = 0; plane < s.in->numPlanes; plane++) {
+            if (general[plane] && cubic) {
+                g->cubic[plane] = getCubicSpline(first.segments[plane], scale);
+                cubic = g->cubic[plane] && matchesGraph(filter, g->cubic[plane].get(), g->graph[plane].get(), lutSize);
+            }
         }
 
-        last = point;
+        if (cubic) {
+            for (int plane = 0; plane < s.in->numPlanes; plane++) {
+                if (general[plane]) {
+                    if (s.level >= 2)
+                        g->filter[plane] = stream ? filter_cubic_avx512<true> : filter_cubic_avx512<false>;
+                    else
+                        g->filter[plane] = stream ? filter_cubic_avx2<true> : filter_cubic_avx2<false>;
+                    g->lut[plane] = g->cubic[plane].get();
+                }
+            }
+        } else {
+            for (int plane = 0; plane < s.in->numPlanes; plane++)
+                g->cubic[plane].reset();
+        }
     }
 
-    if (points && !points->next)
-        throw std::string{ "only one point is defined, this is unlikely to behave as you expect" };
-}
+    // the compact LUT only pays off once the flat one outgrows the L1 cache, and it needs all looked up planes to fit
+    if (!isFloat && !convert && !dithered && s.in->bitsPerSample >= 14 && s.level >= 1 && compact != 0 && !cubic && anyGeneral) {
+        filter_t filter;
+        if (s.level >= 2)
+            filter = stream ? filter_compact_avx512<true> : filter_compact_avx512<false>;
+        else
+            filter = stream ? filter_compact_avx2<true> : filter_compact_avx2<false>;
+
+        // the timing does not depend on the curve, so the LUTs are only compacted once it favours them
+        bool compactable = compact == 1 || isCompactFaster(s.level, stream, lookup, filter, scale);
 
-static int getNumPoints(const keypoint * d) noexcept {
-    int n = 0;
-    while (d) {
-        n++;
-        d = d->next.get();
+        for (int plane = 0; plane < s.in->numPlanes; plane++) {
+            if (general[plane] && compactable) {
+                g->compact[plane] = compactGraph(g->graph[plane].get(), lutSize);
+                compactable = !!g->compact[plane];
+            }
+        }
+
+        if (compactable) {
+            for (int plane = 0; plane < s.in->numPlanes; plane++) {
+                if (general[plane]) {
+                    g->filter[plane] = filter;
+                    g->lut[plane] = g->compact[plane].get();
+                }
+            }
+        } else {
+            for (int plane = 0; plane < s.in->numPlanes; plane++)
+                g->compact[plane].reset();
+        }
     }
-    return n;
+#endif
+
+    return g;
 }
 
 /**
- * Natural cubic spline interpolation
- * Finding curves using Cubic Splines notes by Steven Rauch and John Stockie
+ * Reads a grade file, where each line maps a range of frames to a stage written like those of Compose, as in
+ * "120 250 acv=shot12.acv master=0,0,1,0.95" with the first and the last frame. Empty lines and lines starting with # are
+ * skipped. Equal stages share one grade, so that a look recurring over an episode is compiled once. The ranges are returned
+ * in order, for a binary search.
  */
-static void interpolate(const keypoint * points, uint16_t * VS_RESTRICT y, const int lutSize, const int scale) {
-    const keypoint * point = points;
-    double xPrev = 0.0;
+static std::vector<GradeRange> loadGrades(const char * path, const Settings & s, std::vector<std::string> & files) {
+    FILE * file = openFile(path);
+
+    std::string text;
+    char buffer[4096];
+    for (size_t size; (size = std::fread(buffer, 1, sizeof(buffer), file)) > 0;)
+        text.append(buffer, size);
+
+    const bool failed = !!std::ferror(file);
+    std::fclose(file);
+    if (failed)
+        throw std::string{ "error reading file " } + path;
+
+    std::vector<GradeRange> ranges;
+    std::unordered_map<std::string, std::shared_ptr<const Grade>> grades;
+    std::istringstream lines{ text };
+    std::string line;
+
+    for (int number = 1; std::getline(lines, line); number++) {
+        std::istringstream fields{ line };
+        fields.imbue(std::locale::classic());
+
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        try {
+            int64_t first, last;
+            if (!(fields >> first >> last) || (!fields.eof() && !std::isspace(fields.peek())))
+                throw std::string{ "expected the first and the last frame of a range" };
+
+            if (std::min(first, last) < 0 || std::max(first, last) > INT_MAX)
+                throw std::string{ "frame numbers must be between 0 and INT_MAX" };
+            if (last < first)
+                throw std::string{ "the last frame must not come before the first one" };
+
+            std::string spec;
+            std::getline(fields, spec);
+
+            std::shared_ptr<const Grade> & grade = grades[spec];
+            if (!grade) {
+                const Stage stage = parseStage(spec);
+                files.push_back(stage.acv);
+                grade = compileGrade(s, { stage }, std::max(s.compact, 0));
+            }
+
+            ranges.push_back({ static_cast<int>(first), static_cast<int>(last), grade });
+        } catch (const std::string & error) {
+            throw std::string{ path } + " line " + std::to_string(number) + ": " + error;
+        }
+    }
 
-    const int n = getNumPoints(points); // number of splines
+    std::sort(ranges.begin(), ranges.end(), [](const GradeRange & a, const GradeRange & b) { return a.first < b.first; });
 
-    if (n == 0) {
-        for (int i = 0; i < lutSize; i++)
-            y[i] = i;
-        return;
+    for (size_t i = 1; i < ranges.size(); i++) {
+        if (ranges[i].first <= ranges[i - 1].last)
+            throw std::string{ path } + ": frame " + std::to_string(ranges[i].first) + " is in more than one range";
     }
 
-    double (*matrix)[3] = reinterpret_cast<double(*)[3]>(calloc(n, sizeof(*matrix)));
-    double * h = reinterpret_cast<double *>(malloc((n - 1) * sizeof(*h)));
-    double * r = reinterpret_cast<double *>(calloc(n, sizeof(*r)));
-    if (!matrix || !h || !r)
-        throw std::string{ "malloc failure (matrix/h/r)" };
+    return ranges;
+}
 
-    // h(i) = x(i+1) - x(i)
-    int i = -1;
-    for (point = points; point; point = point->next.get()) {
-        if (i != -1)
-            h[i] = point->x - xPrev;
-        xPrev = point->x;
-        i++;
+/**
+ * Blends the curves of two keyframes at position t between them into the LUTs of a frame. Both keyframes are looked up by
+ * the same kernels, so the frame is still processed by a single lookup. Integer samples are rounded inline like getSample
+ * does, so that the loop over the LUT is vectorized, which leaves only half precision to quantize.
+ */
+static std::shared_ptr<const Grade> blendGrades(const Grade & a, const Grade & b, const float t) {
+    auto g = std::make_shared<Grade>();
+    const int lutSize = a.lutSize;
+    g->fused = a.fused;
+    g->dither = a.dither;
+
+    for (int plane = 0; plane < 3; plane++) {
+        g->process[plane] = a.process[plane];
+        if (!a.process[plane])
+            continue;
+
+        const float * VS_RESTRICT from = a.ramp[plane].get();
+        const float * VS_RESTRICT to = b.ramp[plane].get();
+        const Quantizer & q = a.quantizer[plane];
+        g->filter[plane] = a.filter[plane];
+
+        if (a.floatGraph[plane]) {
+            // the blends are cached as whole grades, so their LUTs are not interned
+            float * VS_RESTRICT graph = new float[lutSize];
+            g->floatGraph[plane] = std::shared_ptr<const float>{ graph, std::default_delete<float[]>{} };
+            for (int i = 0; i < lutSize; i++)
+                graph[i] = from[i] + (to[i] - from[i]) * t - q.offset;
+            g->lut[plane] = graph;
+        } else {
+            uint16_t * VS_RESTRICT graph = new uint16_t[lutSize + 1]();
+            g->graph[plane] = std::shared_ptr<const uint16_t>{ graph, std::default_delete<uint16_t[]>{} };
+
+            if (q.half) {
+                for (int i = 0; i < lutSize; i++)
+                    quantize(graph[i], from[i] + (to[i] - from[i]) * t, q);
+            } else {
+                const double black = q.levels.black;
+                const double span = q.levels.white - q.levels.black;
+                const int peak = q.levels.peak;
+
+                for (int i = 0; i < lutSize; i++) {
+                    const double y = from[i] + (to[i] - from[i]) * t;
+                    graph[i] = static_cast<uint16_t>(std::min(std::max(static_cast<int>(black + y * span + 0.5), 0), peak));
+                }
+            }
+
+            if (a.lut[plane] == &a.ditherMap[plane]) {
+                g->ditherMap[plane] = a.ditherMap[plane];
+                g->ditherMap[plane].graph = graph;
+                g->lut[plane] = &g->ditherMap[plane];
+            } else {
+                g->lut[plane] = graph;
+            }
+        }
     }
 
-    // right-side of the polynomials, will be modified to contain the solution
-    point = points;
-    for (i = 1; i < n - 1; i++) {
-        const double yp = point->y;
-        const double yc = point->next->y;
-        const double yn = point->next->next->y;
-        r[i] = 6 * ((yn - yc) / h[i] - (yc - yp) / h[i - 1]);
-        point = point->next.get();
+    return g;
+}
+
+/**
+ * Compiles all curves of a filter, and lists the files they were read from. Compact is the setting that the curves of the
+ * filter are compiled with, which is given by the previous curves when they are reloaded.
+ */
+static std::shared_ptr<const Curves> compileCurves(const Settings & s, const Sources & sources, const int compact) {
+    auto c = std::make_shared<Curves>();
+    std::vector<std::string> & files = c->files;
+    c->compact = std::max(compact, 0);
+
+    // equal looks share a grade, so that a look held over several keyframes is not blended with itself
+    for (size_t i = 0; i < sources.looks.size(); i++) {
+        const auto same = std::find(sources.looks.cbegin(), sources.looks.cbegin() + i, sources.looks[i]);
+        if (same != sources.looks.cbegin() + i) {
+            c->looks.push_back(c->looks[same - sources.looks.cbegin()]);
+            continue;
+        }
+
+        try {
+            const Stage look = parseStage(sources.looks[i]);
+            files.push_back(look.acv);
+            c->looks.push_back(compileGrade(s, { look }, std::max(s.compact, 0), true));
+        } catch (const std::string & error) {
+            throw "look " + std::to_string(i) + ": " + error;
+        }
     }
 
-    constexpr int BD = 0; // sub  diagonal (below main)
-    constexpr int MD = 1; // main diagonal (center)
-    constexpr int AD = 2; // sup  diagonal (above main)
+    c->keyframes = sources.keyframes;
+    if (!c->looks.empty())
+        c->blends = std::make_unique<LruCache<Grade>>(s.cache);
 
-    // left side of the polynomials into a tridiagonal matrix
-    matrix[0][MD] = matrix[n - 1][MD] = 1;
-    for (i = 1; i < n - 1; i++) {
-        matrix[i][BD] = h[i - 1];
-        matrix[i][MD] = 2 * (h[i - 1] + h[i]);
-        matrix[i][AD] = h[i];
+    if (sources.looks.empty()) {
+        for (const Stage & stage : sources.stages)
+            files.push_back(stage.acv);
+        c->grade = compileGrade(s, sources.stages, compact);
+        if (compact < 0)
+            c->compact = c->grade->compact[0] || c->grade->compact[1] || c->grade->compact[2];
     }
 
-    // tridiagonal solving of the linear system
-    for (i = 1; i < n; i++) {
-        const double den = matrix[i][MD] - matrix[i][BD] * matrix[i - 1][AD];
-        const double k = den ? 1.0 / den : 1.0;
-        matrix[i][AD] *= k;
-        r[i] = (r[i] - matrix[i][BD] * r[i - 1]) * k;
+    if (!sources.grades.empty()) {
+        files.push_back(sources.grades);
+        c->ranges = loadGrades(sources.grades.c_str(), s, files);
     }
-    for (i = n - 2; i >= 0; i--)
-        r[i] = r[i] - matrix[i][AD] * r[i + 1];
 
-    point = points;
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    if (!files.empty() && files.front().empty())
+        files.erase(files.begin());
 
-    // left padding
-    for (i = 0; i < static_cast<int>(point->x * scale + 0.5); i++)
-        y[i] = std::min(std::max(static_cast<int>(point->y * scale + 0.5), 0), scale);
+    return c;
+}
 
-    // compute the graph with x=[x0..xN]
-    i = 0;
-    while (point->next) {
-        const double yc = point->y;
-        const double yn = point->next->y;
+/**
+ * Returns the grade of a frame from the keyframes around it, holding the first and the last one beyond them. Blends are
+ * cached, so that a frame that is requested again, e.g. by a temporal filter, is not blended again.
+ */
+static std::shared_ptr<const Grade> getKeyframeGrade(const Curves & c, const int n) {
+    const auto next = std::upper_bound(c.keyframes.cbegin(), c.keyframes.cend(), n);
+    if (next == c.keyframes.cbegin())
+        return c.looks.front();
+    if (next == c.keyframes.cend())
+        return c.looks.back();
+
+    const size_t i = next - c.keyframes.cbegin() - 1;
+    if (n == c.keyframes[i] || c.looks[i] == c.looks[i + 1])
+        return c.looks[i];
+
+    // equal looks share a grade, so the pair is named by the first look holding each one, and t by its bits
+    const float t = static_cast<float>(n - c.keyframes[i]) / (c.keyframes[i + 1] - c.keyframes[i]);
+    const auto from = std::find(c.looks.cbegin(), c.looks.cend(), c.looks[i]);
+    const auto to = std::find(c.looks.cbegin(), c.looks.cend(), c.looks[i + 1]);
+    uint32_t bits;
+    std::memcpy(&bits, &t, sizeof(bits));
+    const std::string key = std::to_string(from - c.looks.cbegin()) + ' ' + std::to_string(to - c.looks.cbegin()) + ' ' + std::to_string(bits);
+
+    std::shared_ptr<const Grade> grade = c.blends->find(key);
+    if (grade)
+        return grade;
+
+    return c.blends->insert(key, blendGrades(*c.looks[i], *c.looks[i + 1], t));
+}
+
+/**
+ * Returns the grade of a frame, which is compiled from the stages in its property the first time they are seen and taken
+ * from the cache afterwards. Frames without the property use the range of the grade file they are in, and then the
+ * keyframes or the curves of the filter.
+ */
+static std::shared_ptr<const Grade> getFrameGrade(const CurveData * d, const Curves & c, const int n, const VSMap * props, const VSAPI * vsapi) {
+    const char * prop = d->prop.c_str();
+    const int numStages = d->cache ? vsapi->propNumElements(props, prop) : 0;
+    if (numStages <= 0) {
+        auto range = std::upper_bound(c.ranges.cbegin(), c.ranges.cend(), n, [](const int n, const GradeRange & range) {
+            return n < range.first;
+        });
+        if (range != c.ranges.cbegin() && n <= (--range)->last)
+            return range->grade;
+
+        return c.keyframes.empty() ? c.grade : getKeyframeGrade(c, n);
+    }
+
+    if (vsapi->propGetType(props, prop) != ptData)
+        throw "frame property " + d->prop + " must hold stages as strings";
+
+    // the stages themselves identify the curves, so that equal scenes share one grade however they are tagged
+    std::string key;
+    for (int i = 0; i < numStages; i++) {
+        key.append(vsapi->propGetData(props, prop, i, nullptr), vsapi->propGetDataSize(props, prop, i, nullptr));
+        key.push_back('\0');
+    }
 
-        const double a = yc;
-        const double b = (yn - yc) / h[i] - h[i] * r[i] / 2.0 - h[i] * (r[i + 1] - r[i]) / 6.0;
-        const double c = r[i] / 2.0;
-        const double d = (r[i + 1] - r[i]) / (6.0 * h[i]);
+    std::shared_ptr<const Grade> grade = d->cache->find(key);
+    if (grade)
+        return grade;
 
-        const int xStart = static_cast<int>(point->x * scale + 0.5);
-        const int xEnd = static_cast<int>(point->next->x * scale + 0.5);
-        for (int x = xStart; x <= xEnd; x++) {
-            const double xx = static_cast<double>(x - xStart) / scale;
-            const double yy = a + b * xx + c * xx * xx + d * xx * xx * xx;
-            y[x] = std::min(std::max(static_cast<int>(yy * scale + 0.5), 0), scale);
+    std::vector<Stage> stages;
+    for (int i = 0; i < numStages; i++) {
+        try {
+            stages.push_back(parseStage(vsapi->propGetData(props, prop, i, nullptr)));
+        } catch (const std::string & error) {
+            throw numStages > 1 || d->settings.compose ? "stage " + std::to_string(i) + ": " + error : error;
         }
+    }
+
+    // two threads missing the same curves both compile them, and the one that comes second gets the grade of the first
+    return d->cache->insert(key, compileGrade(d->settings, stages, std::max(d->settings.compact, 0)));
+}
 
-        point = point->next.get();
-        i++;
+/**
+ * Compiles the curves again once a file they were read from has changed, checking at most every quarter of a second, and
+ * swaps them in for the frames that start afterwards. A single thread checks the files at a time, and the others go on
+ * with the curves they have instead of waiting for it. Curves that fail to compile, e.g. from a file that is still being
+ * written, are reported and the previous ones are kept until the next change.
+ */
+static void reloadCurves(CurveData * d, const VSAPI * vsapi) {
+    Watch & watch = *d->watch;
+    std::unique_lock<std::mutex> lock{ watch.mutex, std::try_to_lock };
+    const auto now = std::chrono::steady_clock::now();
+    if (!lock || now < watch.next)
+        return;
+
+    watch.next = now + std::chrono::milliseconds{ 250 };
+
+    const std::shared_ptr<const Curves> curves = std::atomic_load(&d->curves);
+    bool changed = false;
+
+    for (size_t i = 0; i < curves->files.size(); i++) {
+        const FileStamp stamp = getFileStamp(curves->files[i]);
+        changed |= stamp.time != watch.stamps[i].time || stamp.size != watch.stamps[i].size;
+        watch.stamps[i] = stamp;
     }
 
-    // right padding
-    for (i = static_cast<int>(point->x * scale + 0.5); i < lutSize; i++)
-        y[i] = std::min(std::max(static_cast<int>(point->y * scale + 0.5), 0), scale);
+    if (!changed)
+        return;
 
-    free(matrix);
-    free(h);
-    free(r);
+    std::shared_ptr<const Curves> reloaded;
+    try {
+        reloaded = compileCurves(d->settings, d->sources, curves->compact);
+    } catch (const std::string & error) {
+        vsapi->logMessage(mtWarning, (std::string{ d->name } + ": " + error + ", keeping the previous curves").c_str());
+        return;
+    }
+
+    // files that were already watched keep the stamps from before they were read, so that a write that completes during
+    // the compilation is not missed
+    std::vector<FileStamp> stamps;
+    for (const std::string & file : reloaded->files) {
+        const auto known = std::find(curves->files.cbegin(), curves->files.cend(), file);
+        stamps.push_back(known != curves->files.cend() ? watch.stamps[known - curves->files.cbegin()] : getFileStamp(file));
+    }
+
+    watch.stamps = std::move(stamps);
+    std::atomic_store(&d->curves, reloaded);
+
+    if (d->cache)
+        d->cache->clear();
 }
 
-template<typename T>
-static void filter(const VSFrameRef * src, VSFrameRef * dst, const CurveData * const VS_RESTRICT d, const VSAPI * vsapi) noexcept {
-    for (int plane = 0; plane < d->vi->format->numPlanes; plane++) {
-        if (d->process[plane]) {
-            const int width = vsapi->getFrameWidth(src, plane);
-            const int height = vsapi->getFrameHeight(src, plane);
-            const int stride = vsapi->getStride(src, plane) / sizeof(T);
-            const T * srcp = reinterpret_cast<const T *>(vsapi->getReadPtr(src, plane));
-            T * VS_RESTRICT dstp = reinterpret_cast<T *>(vsapi->getWritePtr(dst, plane));
-
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++)
-                    dstp[x] = static_cast<T>(d->graph[plane][srcp[x]]);
-
-                srcp += stride;
-                dstp += stride;
+/**
+ * Runs the kernels of a grade over the processed planes of a frame, whose strides are in bytes. The planes are split into
+ * bands of rows when they are fused or threaded.
+ */
+static void applyGrade(const Grade & grade, const int numPlanes, const uint8_t * const srcp[3], uint8_t * const dstp[3], const int width[3],
+                       const int height[3], const int srcStride[3], const int dstStride[3], const int inBytes, const int outBytes,
+                       const int threads, ThreadPool * pool) {
+    const bool * process = grade.process;
+    int bandHeight[3] = {}, numBands[3] = {};
+    int totalStride = 0, totalBands = 0;
+
+    for (int plane = 0; plane < numPlanes; plane++) {
+        if (process[plane])
+            totalStride += srcStride[plane];
+    }
+
+    // A band is a range of rows, of a single plane or, in fused mode, of all processed planes at once.
+    // Without fusing or threading every plane is processed as a single band, and so it is with error diffusion.
+    // The bands of ordered dithering start on the period of its pattern.
+    for (int plane = 0; plane < numPlanes; plane++) {
+        if (process[plane]) {
+            bandHeight[plane] = height[plane];
+            if ((grade.fused || threads > 1) && grade.dither != ditherErrorDiffusion)
+                bandHeight[plane] = getBandHeight(height[plane], grade.fused ? totalStride : srcStride[plane], threads);
+            if (grade.dither == ditherOrdered)
+                bandHeight[plane] = (bandHeight[plane] + 7) & ~7;
+
+            numBands[plane] = (height[plane] + bandHeight[plane] - 1) / bandHeight[plane];
+            totalBands = grade.fused ? numBands[plane] : totalBands + numBands[plane];
+        }
+    }
+
+    const auto processBand = [&](int band) {
+        for (int plane = 0; plane < numPlanes; plane++) {
+            if (!process[plane])
+                continue;
+
+            if (!grade.fused && band >= numBands[plane]) {
+                band -= numBands[plane];
+                continue;
             }
+
+            const int y = band * bandHeight[plane];
+            grade.filter[plane](srcp[plane] + static_cast<ptrdiff_t>(y) * srcStride[plane], dstp[plane] + static_cast<ptrdiff_t>(y) * dstStride[plane],
+                                width[plane], std::min(bandHeight[plane], height[plane] - y),
+                                srcStride[plane] / inBytes, dstStride[plane] / outBytes, grade.lut[plane]);
+
+            if (!grade.fused)
+                break;
         }
+    };
+
+    if (threads > 1) {
+        pool->parallelFor(totalBands, threads - 1, processBand);
+    } else {
+        for (int band = 0; band < totalBands; band++)
+            processBand(band);
     }
 }
 
 static void VS_CC curveInit(VSMap * in, VSMap * out, void ** instanceData, VSNode * node, VSCore * core, const VSAPI * vsapi) {
     CurveData * d = static_cast<CurveData *>(*instanceData);
-    vsapi->setVideoInfo(d->vi, 1, node);
+    VSVideoInfo vi = *d->vi;
+    vi.format = d->format;
+    vsapi->setVideoInfo(&vi, 1, node);
 }
 
 static const VSFrameRef * VS_CC curveGetFrame(int n, int activationReason, void ** instanceData, void ** frameData, VSFrameContext * frameCtx, VSCore * core, const VSAPI * vsapi) {
-    const CurveData * d = static_cast<const CurveData *>(*instanceData);
+    CurveData * d = static_cast<CurveData *>(*instanceData);
 
     if (activationReason == arInitial) {
         vsapi->requestFrameFilter(n, d->node, frameCtx);
     } else if (activationReason == arAllFramesReady) {
         const VSFrameRef * src = vsapi->getFrameFilter(n, d->node, frameCtx);
-        const VSFrameRef * fr[] = { d->process[0] ? nullptr : src, d->process[1] ? nullptr : src, d->process[2] ? nullptr : src };
+
+        if (d->watch)
+            reloadCurves(d, vsapi);
+
+        const std::shared_ptr<const Curves> curves = d->watch ? std::atomic_load(&d->curves) : d->curves;
+
+        std::shared_ptr<const Grade> grade;
+        try {
+            grade = getFrameGrade(d, *curves, n, vsapi->getFramePropsRO(src), vsapi);
+        } catch (const std::string & error) {
+            vsapi->setFilterError((std::string{ d->name } + ": " + error).c_str(), frameCtx);
+            vsapi->freeFrame(src);
+            return nullptr;
+        }
+
+        const bool * process = grade->process;
+        const VSFrameRef * fr[] = { process[0] ? nullptr : src, process[1] ? nullptr : src, process[2] ? nullptr : src };
         const int pl[] = { 0, 1, 2 };
-        VSFrameRef * dst = vsapi->newVideoFrame2(d->vi->format, d->vi->width, d->vi->height, fr, pl, src, core);
+        VSFrameRef * dst = vsapi->newVideoFrame2(d->format, d->vi->width, d->vi->height, fr, pl, src, core);
+
+        const uint8_t * srcp[3] = {};
+        uint8_t * dstp[3] = {};
+        int width[3] = {}, height[3] = {}, srcStride[3] = {}, dstStride[3] = {};
+
+        for (int plane = 0; plane < d->vi->format->numPlanes; plane++) {
+            if (process[plane]) {
+                srcp[plane] = vsapi->getReadPtr(src, plane);
+                dstp[plane] = vsapi->getWritePtr(dst, plane);
+                width[plane] = vsapi->getFrameWidth(src, plane);
+                height[plane] = vsapi->getFrameHeight(src, plane);
+                srcStride[plane] = vsapi->getStride(src, plane);
+                dstStride[plane] = vsapi->getStride(dst, plane);
+            }
+        }
 
-        if (d->vi->format->bytesPerSample == 1)
-            filter<uint8_t>(src, dst, d, vsapi);
-        else
-            filter<uint16_t>(src, dst, d, vsapi);
+        applyGrade(*grade, d->vi->format->numPlanes, srcp, dstp, width, height, srcStride, dstStride, d->vi->format->bytesPerSample,
+                   d->format->bytesPerSample, d->threads, d->pool.get());
 
         vsapi->freeFrame(src);
         return dst;
@@ -248,14 +2123,19 @@ static void VS_CC curveCreate(const VSMap * in, VSMap * out, void * userData, VS
     std::unique_ptr<CurveData> d = std::make_unique<CurveData>();
     int err;
 
+    // Compose shares everything but the way the curves are given
+    const char * name = static_cast<const char *>(userData);
+    const bool compose = !strcmp(name, "Compose");
+
     d->node = vsapi->propGetNode(in, "clip", 0, nullptr);
     d->vi = vsapi->getVideoInfo(d->node);
+    d->name = name;
 
     try {
         if (!isConstantFormat(d->vi) ||
             (d->vi->format->sampleType == stInteger && d->vi->format->bitsPerSample > 16) ||
-            d->vi->format->sampleType == stFloat)
-            throw std::string{ "only constant format 8-16 bit integer input supported" };
+            (d->vi->format->sampleType == stFloat && d->vi->format->bitsPerSample != 16 && d->vi->format->bitsPerSample != 32))
+            throw std::string{ "only constant format 8-16 bit integer and 16/32 bit float input supported" };
 
         const int preset = int64ToIntS(vsapi->propGetInt(in, "preset", 0, &err));
 
@@ -275,8 +2155,81 @@ static void VS_CC curveCreate(const VSMap * in, VSMap * out, void * userData, VS
 
         const int numPlanes = vsapi->propNumElements(in, "planes");
 
+        const bool fused = !!vsapi->propGetInt(in, "fused", 0, &err);
+
+        d->threads = int64ToIntS(vsapi->propGetInt(in, "threads", 0, &err));
+        if (err)
+            d->threads = 1;
+
+        const int opt = int64ToIntS(vsapi->propGetInt(in, "opt", 0, &err));
+
+        int stream = int64ToIntS(vsapi->propGetInt(in, "stream", 0, &err));
+        if (err)
+            stream = -1;
+
+        int compact = int64ToIntS(vsapi->propGetInt(in, "compact", 0, &err));
+        if (err)
+            compact = -1;
+
+        const int engine = int64ToIntS(vsapi->propGetInt(in, "engine", 0, &err));
+
+        const int dither = int64ToIntS(vsapi->propGetInt(in, "dither", 0, &err));
+
+        const int range = int64ToIntS(vsapi->propGetInt(in, "range", 0, &err));
+
+        const auto getTransfer = [&](const char * name, const Transfer fallback) {
+            const char * value = vsapi->propGetData(in, name, 0, &err);
+            if (err)
+                return fallback;
+
+            for (size_t i = 0; i < sizeof(transferNames) / sizeof(transferNames[0]); i++) {
+                if (!strcmp(value, transferNames[i]))
+                    return static_cast<Transfer>(i);
+            }
+
+            throw std::string{ name } + " must be linear, srgb, bt1886, pq, hlg, slog3, logc3, or vlog";
+        };
+
+        const int numExpr = vsapi->propNumElements(in, "expr");
+
+        const char * prop = vsapi->propGetData(in, "prop", 0, &err);
+
+        int cache = int64ToIntS(vsapi->propGetInt(in, "cache", 0, &err));
+        if (err)
+            cache = 16;
+
+        const char * grades = vsapi->propGetData(in, "grades", 0, &err);
+
+        const bool watch = !!vsapi->propGetInt(in, "watch", 0, &err);
+
+        const int numKeyframes = vsapi->propNumElements(in, "keyframes");
+        const int numLooks = vsapi->propNumElements(in, "looks");
+
+        const Transfer transferIn = getTransfer("transfer_in", transferLinear);
+        const Transfer transferOut = getTransfer("transfer_out", transferIn);
+
+        d->format = d->vi->format;
+        const int format = int64ToIntS(vsapi->propGetInt(in, "format", 0, &err));
+        if (!err)
+            d->format = vsapi->getFormatPreset(format, core);
+
+        if (!d->format)
+            throw std::string{ "invalid format" };
+
+        if (d->format->colorFamily != d->vi->format->colorFamily ||
+            d->format->subSamplingW != d->vi->format->subSamplingW ||
+            d->format->subSamplingH != d->vi->format->subSamplingH)
+            throw std::string{ "format must have the same color family and subsampling as the input clip" };
+
+        if ((d->format->sampleType == stInteger && (d->format->bitsPerSample < 8 || d->format->bitsPerSample > 16)) ||
+            (d->format->sampleType == stFloat && d->format->bitsPerSample != 16 && d->format->bitsPerSample != 32))
+            throw std::string{ "format must be 8-16 bit integer or 16/32 bit float" };
+
+        const bool convert = d->format->id != d->vi->format->id;
+
+        bool listed[3];
         for (int i = 0; i < 3; i++)
-            d->process[i] = (numPlanes <= 0);
+            listed[i] = (numPlanes <= 0);
 
         for (int i = 0; i < numPlanes; i++) {
             const int plane = int64ToIntS(vsapi->propGetInt(in, "planes", i, nullptr));
@@ -284,185 +2237,179 @@ static void VS_CC curveCreate(const VSMap * in, VSMap * out, void * userData, VS
             if (plane < 0 || plane >= d->vi->format->numPlanes)
                 throw std::string{ "plane index out of range" };
 
-            if (d->process[plane])
+            if (listed[plane])
                 throw std::string{ "plane specified twice" };
 
-            d->process[plane] = true;
+            listed[plane] = true;
         }
 
-        if (preset < 0 || preset > 10)
-            throw std::string{ "preset must be 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, or 10" };
+        if (opt < 0 || opt > 3)
+            throw std::string{ "opt must be 0, 1, 2, or 3" };
 
-        if (r && (numR & 1))
-            throw std::string{ "the number of elements in r must be a multiple of 2" };
+        if (stream < -1 || stream > 1)
+            throw std::string{ "stream must be -1, 0, or 1" };
 
-        if (g && (numG & 1))
-            throw std::string{ "the number of elements in g must be a multiple of 2" };
+        if (dither < 0 || dither > 2)
+            throw std::string{ "dither must be 0, 1, or 2" };
 
-        if (b && (numB & 1))
-            throw std::string{ "the number of elements in b must be a multiple of 2" };
+        if (range < 0 || range > 1)
+            throw std::string{ "range must be 0 or 1" };
 
-        if (master && (numMaster & 1))
-            throw std::string{ "the number of elements in master must be a multiple of 2" };
+        if (compact < -1 || compact > 1)
+            throw std::string{ "compact must be -1, 0, or 1" };
 
-        std::vector<double> curve[4];
+        if (engine < 0 || engine > 1)
+            throw std::string{ "engine must be 0 or 1" };
 
-        if (r)
-            curve[0].assign(r, r + numR);
+        if (d->threads < 0)
+            throw std::string{ "threads must be greater than or equal to 0" };
 
-        if (g)
-            curve[1].assign(g, g + numG);
+        if (cache < 1)
+            throw std::string{ "cache must be greater than or equal to 1" };
 
-        if (b)
-            curve[2].assign(b, b + numB);
+        const int numCpus = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+        if (d->threads == 0 || d->threads > numCpus)
+            d->threads = numCpus;
 
-        if (master)
-            curve[3].assign(master, master + numMaster);
+        if (d->threads > 1)
+            d->pool = ThreadPool::acquire();
 
-        if (acv) {
-            FILE * acvFile = nullptr;
-
-#ifdef _WIN32
-            const int requiredSize = MultiByteToWideChar(CP_UTF8, 0, acv, -1, nullptr, 0);
-            std::unique_ptr<wchar_t[]> wbuffer = std::make_unique<wchar_t[]>(requiredSize);
-            MultiByteToWideChar(CP_UTF8, 0, acv, -1, wbuffer.get(), requiredSize);
-            acvFile = _wfopen(wbuffer.get(), L"rb");
+        // 0 = C, 1 = AVX2, 2 = AVX-512, 3 = AVX-512 with VBMI
+#ifdef CURVE_X86
+        const int simdLevel = getSimdLevel();
 #else
-            acvFile = std::fopen(acv, "rb");
+        const int simdLevel = 0;
 #endif
-            if (!acvFile)
-                throw std::string{ "error opening file " } + acv + " (" + std::strerror(errno) + ")";
 
-            if (std::fseek(acvFile, 0, SEEK_END)) {
-                std::fclose(acvFile);
-                throw std::string{ "error seeking to the end of file " } + acv + " (" + std::strerror(errno) + ")";
-            }
+        if (opt >= 2 && simdLevel < opt - 1)
+            throw std::string{ opt == 2 ? "AVX2" : "AVX-512" } + " is not supported by this CPU";
 
-            long size = std::ftell(acvFile);
-            if (size == -1) {
-                std::fclose(acvFile);
-                throw std::string{ "error determining the size of file " } + acv + " (" + std::strerror(errno) + ")";
-            }
+        int level = simdLevel;
+        if (opt == 1)
+            level = 0;
+        else if (opt == 2)
+            level = 1;
 
-            std::rewind(acvFile);
+        std::vector<Stage> & stages = d->sources.stages;
 
-            std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(size);
-            uint8_t * buf = buffer.get();
-            if (std::fread(buf, 1, size, acvFile) != static_cast<size_t>(size)) {
-                std::fclose(acvFile);
-                throw std::string{ "error reading file " } + acv + " (" + std::strerror(errno) + ")";
+        if (compose) {
+            const int numStages = vsapi->propNumElements(in, "stages");
+            if (numStages < 1)
+                throw std::string{ "at least one stage must be given" };
+
+            for (int i = 0; i < numStages; i++) {
+                try {
+                    stages.push_back(parseStage(vsapi->propGetData(in, "stages", i, nullptr)));
+                } catch (const std::string & error) {
+                    throw "stage " + std::to_string(i) + ": " + error;
+                }
             }
+        } else {
+            stages.resize(1);
+            Stage & stage = stages.front();
 
-            std::fclose(acvFile);
+            if (r)
+                stage.curve[0].assign(r, r + numR);
 
-#if defined(__GNUC__) || defined(__clang__)
-#define UNUSED __attribute__((unused))
-#else
-#define UNUSED
-#endif
+            if (g)
+                stage.curve[1].assign(g, g + numG);
 
-#define READ16(dst) do {                         \
-    if (size < 2)                                \
-        throw std::string{ "invalid acv file" }; \
-    dst = (buf[0] << 8) | buf[1];                \
-    buf += 2;                                    \
-    size -= 2;                                   \
-} while (0)
+            if (b)
+                stage.curve[2].assign(b, b + numB);
 
-            int version UNUSED = 0, numCurves = 0;
-            constexpr int curveIndex[] = { 3, 0, 1, 2 };
-            READ16(version);
-            READ16(numCurves);
-
-            for (int i = 0; i < std::min(numCurves, 4); i++) {
-                int numPoints = 0;
-                READ16(numPoints);
-                std::vector<double> acvCurve;
-                const int j = curveIndex[i];
-
-                for (int n = 0; n < numPoints; n++) {
-                    int y = 0, x = 0;
-                    READ16(y);
-                    READ16(x);
-                    acvCurve.push_back(x / 255.0);
-                    acvCurve.push_back(y / 255.0);
-                }
+            if (master)
+                stage.curve[3].assign(master, master + numMaster);
 
-                if (curve[j].empty() && !acvCurve.empty())
-                    curve[j] = acvCurve;
-            }
+            stage.preset = preset;
+            if (acv)
+                stage.acv = acv;
+        }
 
-#undef UNUSED
-#undef READ16
+        Settings & settings = d->settings;
+        settings.in = d->vi->format;
+        settings.out = d->format;
+        settings.width = d->vi->width;
+        settings.height = d->vi->height;
+        settings.compose = compose;
+        settings.fused = fused;
+        settings.level = level;
+        settings.stream = stream;
+        settings.compact = compact;
+        settings.engine = engine;
+        settings.range = range;
+        settings.dither = dither;
+        settings.cache = cache;
+        settings.transferIn = transferIn;
+        settings.transferOut = transferOut;
+        settings.transfers = transferIn != transferLinear || transferOut != transferLinear;
+
+        for (int plane = 0; plane < 3; plane++) {
+            settings.listed[plane] = listed[plane];
+            settings.process[plane] = listed[plane] || convert;
         }
 
-        if (preset == 1) {
-            if (curve[0].empty())
-                curve[0] = { 0.129,1, 0.466,0.498, 0.725,0 };
-            if (curve[1].empty())
-                curve[1] = { 0.109,1, 0.301,0.498, 0.517,0 };
-            if (curve[2].empty())
-                curve[2] = { 0.098,1, 0.235,0.498, 0.423,0 };
-        } else if (preset == 2) {
-            if (curve[0].empty())
-                curve[0] = { 0,0, 0.25,0.156, 0.501,0.501, 0.686,0.745, 1,1 };
-            if (curve[1].empty())
-                curve[1] = { 0,0, 0.25,0.188, 0.38,0.501, 0.745,0.815, 1,0.815 };
-            if (curve[2].empty())
-                curve[2] = { 0,0, 0.231,0.094, 0.709,0.874, 1,1 };
-        } else if (preset == 3) {
-            if (curve[3].empty())
-                curve[3] = { 0,0, 0.5,0.4, 1,1 };
-        } else if (preset == 4) {
-            if (curve[3].empty())
-                curve[3] = { 0,0, 0.149,0.066, 0.831,0.905, 0.905,0.98, 1,1 };
-        } else if (preset == 5) {
-            if (curve[3].empty())
-                curve[3] = { 0,0, 0.4,0.5, 1,1 };
-        } else if (preset == 6) {
-            if (curve[3].empty())
-                curve[3] = { 0,0, 0.305,0.286, 0.694,0.713, 1,1 };
-        } else if (preset == 7) {
-            if (curve[3].empty())
-                curve[3] = { 0,0, 0.286,0.219, 0.639,0.643, 1,1 };
-        } else if (preset == 8) {
-            if (curve[3].empty())
-                curve[3] = { 0,1, 1,0 };
-        } else if (preset == 9) {
-            if (curve[3].empty())
-                curve[3] = { 0,0, 0.301,0.196, 0.592,0.6, 0.686,0.737, 1,1 };
-        } else if (preset == 10) {
-            if (curve[0].empty())
-                curve[0] = { 0,0.11, 0.42,0.51, 1,0.95 };
-            if (curve[1].empty())
-                curve[1] = { 0,0, 0.5,0.48, 1,1 };
-            if (curve[2].empty())
-                curve[2] = { 0,0.22, 0.49,0.44, 1,0.8 };
-        }
-
-        const int lutSize = 1 << d->vi->format->bitsPerSample;
-        const int scale = lutSize - 1;
-        std::shared_ptr<keypoint> points[4];
-
-        for (int i = 0; i < 4; i++) {
-            d->graph[i] = std::make_unique<uint16_t[]>(lutSize);
-            parsePoints(curve[i], points[i], scale);
-            interpolate(points[i].get(), d->graph[i].get(), lutSize, scale);
-        }
-
-        if (!curve[3].empty()) {
-            for (int i = 0; i < 3; i++) {
-                for (int j = 0; j < lutSize; j++)
-                    d->graph[i][j] = d->graph[3][d->graph[i][j]];
-            }
+        const bool isFloat = d->vi->format->sampleType == stFloat;
+
+        if (isFloat && compose)
+            throw std::string{ "only integer input is supported" };
+
+        if (isFloat && settings.transfers)
+            throw std::string{ "transfer_in and transfer_out are only supported for integer input" };
+
+        if (numExpr > d->vi->format->numPlanes)
+            throw std::string{ "more expressions given than there are planes" };
+
+        if (isFloat && numExpr > 0)
+            throw std::string{ "expr is only supported for integer input" };
+
+        if (numKeyframes != numLooks)
+            throw std::string{ "keyframes and looks must have the same number of elements" };
+
+        if (isFloat && numKeyframes > 0)
+            throw std::string{ "keyframes are only supported for integer input" };
+
+        if (numKeyframes > 0 && (preset || r || g || b || master || acv))
+            throw std::string{ "keyframes cannot be combined with preset, r, g, b, master, or acv" };
+
+        // like std.Expr, the last expression is reused for the remaining planes, and an empty one leaves a plane to the curves
+        for (int plane = 0; plane < d->vi->format->numPlanes && numExpr > 0; plane++) {
+            const char * source = vsapi->propGetData(in, "expr", std::min(plane, numExpr - 1), nullptr);
+            if (listed[plane] && source[strspn(source, " \t\r\n")])
+                settings.expression[plane] = std::make_unique<Expression>(source);
+        }
+
+        for (int i = 0; i < numKeyframes; i++) {
+            const int keyframe = int64ToIntS(vsapi->propGetInt(in, "keyframes", i, nullptr));
+            if (i > 0 && keyframe <= d->sources.keyframes.back())
+                throw std::string{ "keyframes must be strictly increasing" };
+
+            d->sources.keyframes.push_back(keyframe);
+            d->sources.looks.push_back(vsapi->propGetData(in, "looks", i, nullptr));
+        }
+
+        if (grades)
+            d->sources.grades = grades;
+
+        d->curves = compileCurves(d->settings, d->sources, d->settings.compact);
+
+        if (watch) {
+            d->watch = std::make_unique<Watch>();
+            d->watch->next = std::chrono::steady_clock::now() + std::chrono::milliseconds{ 250 };
+            for (const std::string & file : d->curves->files)
+                d->watch->stamps.push_back(getFileStamp(file));
+        }
+
+        if (prop && *prop) {
+            d->prop = prop;
+            d->cache = std::make_unique<LruCache<Grade>>(cache);
         }
     } catch (const std::string & error) {
-        vsapi->setError(out, ("Curve: " + error).c_str());
+        vsapi->setError(out, (std::string{ name } + ": " + error).c_str());
         vsapi->freeNode(d->node);
         return;
     }
 
-    vsapi->createFilter(in, out, "Curve", curveInit, curveGetFrame, curveFree, fmParallel, 0, d.release(), core);
+    vsapi->createFilter(in, out, name, curveInit, curveGetFrame, curveFree, fmParallel, 0, d.release(), core);
 }
 
 //////////////////////////////////////////
@@ -478,6 +2425,44 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegiste
                  "b:float[]:opt;"
                  "master:float[]:opt;"
                  "acv:data:opt;"
-                 "planes:int[]:opt;",
-                 curveCreate, nullptr, plugin);
+                 "planes:int[]:opt;"
+                 "fused:int:opt;"
+                 "threads:int:opt;"
+                 "opt:int:opt;"
+                 "stream:int:opt;"
+                 "compact:int:opt;"
+                 "engine:int:opt;"
+                 "format:int:opt;"
+                 "dither:int:opt;"
+                 "range:int:opt;"
+                 "transfer_in:data:opt;"
+                 "transfer_out:data:opt;"
+                 "expr:data[]:opt;"
+                 "grades:data:opt;"
+                 "watch:int:opt;"
+                 "prop:data:opt;"
+                 "cache:int:opt;"
+                 "keyframes:int[]:opt;"
+                 "looks:data[]:opt;",
+                 curveCreate, const_cast<char *>("Curve"), plugin);
+    registerFunc("Compose",
+                 "clip:clip;"
+                 "stages:data[];"
+                 "planes:int[]:opt;"
+                 "fused:int:opt;"
+                 "threads:int:opt;"
+                 "opt:int:opt;"
+                 "stream:int:opt;"
+                 "compact:int:opt;"
+                 "format:int:opt;"
+                 "dither:int:opt;"
+                 "range:int:opt;"
+                 "transfer_in:data:opt;"
+                 "transfer_out:data:opt;"
+                 "expr:data[]:opt;"
+                 "grades:data:opt;"
+                 "watch:int:opt;"
+                 "prop:data:opt;"
+                 "cache:int:opt;",
+                 curveCreate, const_cast<char *>("Compose"), plugin);
 }
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <VapourSynth.h>
+#include <VSHelper.h>
+
+/**
+ * Per-plane kernel. The strides are in samples of the source and of the destination, which may differ in type.
+ * lut is whatever form of the curve the kernel works on: a flat LUT, a compact LUT, a CubicSpline, an AffineMap, a FloatCurve
+ * or a DitherMap.
+ * A flat LUT must be allocated with one spare entry past scale, since the gather kernels fetch 32 bits per lookup.
+ */
+using filter_t = void (*)(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut);
+
+/**
+ * Compact LUT for 14 to 16-bit input. The table is split into blocks of 32 entries. Each block is predicted by
+ * a line from its first entry towards the first entry of the next block, and every entry stores a 4-bit signed
+ * correction to that line. The base of each block is shifted so that its corrections are centred on zero, and the
+ * result is taken modulo 2^16, so a shifted base may wrap around.
+ * Layout in 16-bit words: the number of blocks, one unused word, a (base, signed step) pair per block, then the
+ * corrections packed two per byte with the even entry in the low nibble, then two words of padding so that
+ * 32-bit gathers of the last corrections stay in bounds. With 16-bit input it takes 40 KiB instead of 128 KiB.
+ */
+constexpr int compactShift = 5;
+constexpr int compactMask = (1 << compactShift) - 1;
+
+static inline uint16_t decodeCompact(const uint16_t * lut, const unsigned i) noexcept {
+    const uint16_t * records = lut + 2;
+    const uint8_t * corrections = reinterpret_cast<const uint8_t *>(records + lut[0] * 2);
+    const int base = records[(i >> compactShift) * 2];
+    const int step = static_cast<int16_t>(records[(i >> compactShift) * 2 + 1]);
+    const int correction = (((corrections[i >> 1] >> (i & 1) * 4) & 15) ^ 8) - 8;
+    return static_cast<uint16_t>(base + ((step * static_cast<int>(i & compactMask) + (1 << (compactShift - 1))) >> compactShift) + correction);
+}
+
+/**
+ * Piecewise-cubic form of a curve for the direct evaluation kernels. Segment k starts at knot[k] and is evaluated
+ * as a + b * t + c * t^2 + d * t^3 with t = (x - knot[k]) / scale, then rounded and clamped the same way as the LUT
+ * is filled. Inputs below knot[0] are clamped to it, and the last segment is the constant right padding.
+ */
+struct CubicSpline {
+    static constexpr int maxSegments = 16;
+
+    int numSegments;
+    int scale;
+    int knot[maxSegments];
+    double start[maxSegments];
+    double a[maxSegments];
+    double b[maxSegments];
+    double c[maxSegments];
+    double d[maxSegments];
+};
+
+static inline uint16_t evaluateCubic(const CubicSpline * spline, const int x) noexcept {
+    const int xc = std::max(x, spline->knot[0]);
+    int k = 0;
+    while (k + 1 < spline->numSegments && xc >= spline->knot[k + 1])
+        k++;
+
+    const double t = (static_cast<double>(xc) - spline->start[k]) * (1.0 / spline->scale);
+    const double y = std::fma(std::fma(std::fma(spline->d[k], t, spline->c[k]), t, spline->b[k]), t, spline->a[k]);
+    return std::min(std::max(static_cast<int>(std::fma(y, spline->scale, 0.5)), 0), spline->scale);
+}
+
+/**
+ * Clamped affine form of a curve for the arithmetic kernels, evaluated in 32-bit integers as
+ * y = (mul * (min(max(x, lo), hi) - lo) + add) >> shift. The inversion kernels only read hi, which is then the scale.
+ */
+struct AffineMap {
+    int lo;
+    int hi;
+    int mul;
+    int add;
+    int shift;
+};
+
+static inline int evaluateAffine(const AffineMap * map, const int x) noexcept {
+    return (map->mul * (std::min(std::max(x, map->lo), map->hi) - map->lo) + map->add) >> map->shift;
+}
+
+/**
+ * Spline of a float clip in the [0;1] range. Segment k starts at start[k] and is evaluated as a + b * t + c * t^2 + d * t^3
+ * in Horner form with t = x - start[k], which is the integer path before rounding, with the key points placed as for 16-bit
+ * input. The SIMD kernels use FMA, and the C kernel does not since it has to run on CPUs without it.
+ * Inputs below start[0] are clamped to it, the last segment is the constant right padding and the result is clamped to
+ * [0;1]. A spline without segments leaves the values unchanged.
+ */
+struct FloatSpline {
+    int numSegments;
+    std::vector<float> start;
+    std::vector<float> a;
+    std::vector<float> b;
+    std::vector<float> c;
+    std::vector<float> d;
+};
+
+/**
+ * Curve of a float plane: the spline of the plane followed by the master spline. Chroma planes of YUV clips are centred
+ * on zero, so offset moves them to the [0;1] range of the curves and back.
+ */
+struct FloatCurve {
+    FloatSpline spline[2];
+    float offset;
+};
+
+template<bool fma>
+static inline float evaluateSpline(const FloatSpline * spline, const float x) noexcept {
+    if (!spline->numSegments)
+        return x;
+
+    // written so that NaN ends up at the start like with maxps
+    const float xc = x > spline->start[0] ? x : spline->start[0];
+    int k = 0;
+    for (int i = 1; i < spline->numSegments; i++)
+        k += xc >= spline->start[i];
+
+    const float t = xc - spline->start[k];
+    const float y = fma ? std::fma(std::fma(std::fma(spline->d[k], t, spline->c[k]), t, spline->b[k]), t, spline->a[k])
+                        : ((spline->d[k] * t + spline->c[k]) * t + spline->b[k]) * t + spline->a[k];
+    return std::min(std::max(y, 0.0f), 1.0f);
+}
+
+/**
+ * Conversions of half precision samples for the scalar code, rounding to nearest even like vcvtps2ph. They assume that
+ * no denormals are flushed, which holds since the plugin never changes MXCSR.
+ */
+static inline float halfToFloat(const uint16_t h) noexcept {
+    uint32_t bits = (h & 0x7FFF) << 13;
+    const uint32_t exponent = bits & 0x0F800000;
+    bits += (127 - 15) << 23;
+
+    if (exponent == 0x0F800000) {
+        // infinity or NaN
+        bits += (128 - 16) << 23;
+    } else if (exponent == 0) {
+        // zero or denormal, renormalized by the float subtraction
+        float value;
+        bits += 1 << 23;
+        std::memcpy(&value, &bits, 4);
+        value -= 6.103515625e-05f;
+        std::memcpy(&bits, &value, 4);
+    }
+
+    bits |= (h & 0x8000) << 16;
+    float result;
+    std::memcpy(&result, &bits, 4);
+    return result;
+}
+
+static inline uint16_t floatToHalf(const float x) noexcept {
+    uint32_t bits;
+    std::memcpy(&bits, &x, 4);
+    const uint32_t sign = bits & 0x80000000;
+    bits ^= sign;
+
+    uint32_t result;
+    if (bits >= (127 + 16) << 23) {
+        // overflow to infinity, NaN stays quiet
+        result = bits > 255u << 23 ? 0x7E00 : 0x7C00;
+    } else if (bits < (127 - 14) << 23) {
+        // denormal or zero, rounded by the float addition
+        constexpr uint32_t magicBits = (127 - 15 + 23 - 10 + 1) << 23;
+        float magic, value;
+        std::memcpy(&magic, &magicBits, 4);
+        std::memcpy(&value, &bits, 4);
+        value += magic;
+        std::memcpy(&result, &value, 4);
+        result -= magicBits;
+    } else {
+        const uint32_t odd = (bits >> 13) & 1;
+        bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xFFF + odd;
+        result = bits >> 13;
+    }
+
+    return static_cast<uint16_t>(result | sign >> 16);
+}
+
+// float kernels are instantiated for float and for half precision held in uint16_t, as input and as output
+static inline float toFloat(const float x) noexcept {
+    return x;
+}
+
+static inline float toFloat(const uint16_t x) noexcept {
+    return halfToFloat(x);
+}
+
+static inline void fromFloat(float * dstp, const float x) noexcept {
+    *dstp = x;
+}
+
+static inline void fromFloat(uint16_t * dstp, const float x) noexcept {
+    *dstp = floatToHalf(x);
+}
+
+template<bool fma>
+static inline float evaluateFloat(const FloatCurve * curve, const float x) noexcept {
+    return evaluateSpline<fma>(&curve->spline[1], evaluateSpline<fma>(&curve->spline[0], x + curve->offset)) - curve->offset;
+}
+
+/**
+ * Dithered integer output of fewer than 16 bits. The curve is held with shift bits below the output precision, as a LUT
+ * of integer input in graph or as the FloatCurve of float input in curve, and scale is the highest output value.
+ * The [0;1] range of a FloatCurve maps to black-white.
+ * The ordered dither adds threshold[y & 7][x & 7] before the extra bits are dropped. Each row holds its 8 thresholds
+ * twice, so that 8 consecutive ones can be loaded from any column.
+ */
+struct DitherMap {
+    const uint16_t * graph;
+    const FloatCurve * curve;
+    int scale;
+    int shift;
+    int black;
+    int white;
+    uint16_t threshold[8][16];
+};
+
+#ifdef CURVE_X86
+/**
+ * The stream variants write the destination with non-temporal stores and prefetch the next source row.
+ * They are meant for frames much larger than the last-level cache, where the output would be evicted before the
+ * next filter reads it anyway, so bypassing the cache saves the read-for-ownership of every destination line.
+ */
+template<typename T, bool stream> void filter_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template<typename T, bool stream> void filter_avx512(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template<bool stream> void filter_compact_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut) noexcept;
+template<bool stream> void filter_compact_avx512(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut) noexcept;
+template<bool stream> void filter_cubic_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * spline) noexcept;
+template<bool stream> void filter_cubic_avx512(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * spline) noexcept;
+template<typename T, bool stream> void filter_affine_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template<typename T, bool stream> void filter_invert_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template<typename T, typename U, bool stream> void filter_convert_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template<typename T, typename U, bool stream> void filter_dither_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template<typename T, typename U, bool stream> void filter_float_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template<typename T, typename U, bool stream> void filter_float_avx512(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template<typename T, bool stream> void filter_avx512vbmi(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+
+static constexpr int prefetchRows = 1;
+
+/**
+ * Number of samples to process with scalar code before dstp reaches the alignment required by non-temporal stores.
+ */
+template<typename T>
+static inline int getStreamHead(const T * dstp, const int width, const unsigned alignment) noexcept {
+    const unsigned misalignment = reinterpret_cast<uintptr_t>(dstp) & (alignment - 1);
+    return misalignment ? std::min(width, static_cast<int>((alignment - misalignment) / sizeof(T))) : 0;
+}
+#endif
@@ -0,0 +1,619 @@
+#ifdef CURVE_X86
+#include <type_traits>
+
+#include <immintrin.h>
+
+#include "Curve.h"
+
+template<bool stream>
+static inline void store(uint8_t * dstp, const __m256i x) noexcept {
+    if (stream)
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dstp), x);
+    else
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp), x);
+}
+
+/**
+ * 8-bit lookup without touching memory: the 256-entry table is split into 16 registers by the high nibble.
+ * For register h the index is (src ^ h << 4) + 0x70 with unsigned saturation, which keeps the low nibble
+ * when the high nibble of src equals h and sets the top bit (vpshufb then yields zero) otherwise.
+ */
+template<bool stream>
+static void lookup(const uint8_t * srcp, uint8_t * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const uint16_t * graph) noexcept {
+    __m256i table[16];
+    for (int i = 0; i < 16; i++)
+        table[i] = _mm256_broadcastsi128_si256(_mm_packus_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(graph + i * 16)),
+                                                                _mm_loadu_si128(reinterpret_cast<const __m128i *>(graph + i * 16 + 8))));
+
+    const __m256i bias = _mm256_set1_epi8(0x70);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~31);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<uint8_t>(graph[srcp[x]]);
+
+        for (int x = head; x < widthSimd; x += 32) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+            __m256i result = _mm256_shuffle_epi8(table[0], _mm256_adds_epu8(src, bias));
+
+            for (int i = 1; i < 16; i++) {
+                const __m256i index = _mm256_adds_epu8(_mm256_xor_si256(src, _mm256_set1_epi8(static_cast<char>(i << 4))), bias);
+                result = _mm256_or_si256(result, _mm256_shuffle_epi8(table[i], index));
+            }
+
+            store<stream>(dstp + x, result);
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<uint8_t>(graph[srcp[x]]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<bool stream>
+static void lookup(const uint16_t * srcp, uint16_t * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const uint16_t * graph) noexcept {
+    const int * table = reinterpret_cast<const int *>(graph);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = graph[srcp[x]];
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+
+            // unpack and pack both work within 128-bit lanes, so the original sample order is preserved
+            __m256i lo = _mm256_i32gather_epi32(table, _mm256_unpacklo_epi16(src, zero), 2);
+            __m256i hi = _mm256_i32gather_epi32(table, _mm256_unpackhi_epi16(src, zero), 2);
+            lo = _mm256_and_si256(lo, mask);
+            hi = _mm256_and_si256(hi, mask);
+
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm256_packus_epi32(lo, hi));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = graph[srcp[x]];
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+static inline __m256i decode(const __m256i index, const int * records, const int * corrections) noexcept {
+    const __m256i record = _mm256_i32gather_epi32(records, _mm256_srli_epi32(index, compactShift), 4);
+    const __m256i base = _mm256_and_si256(record, _mm256_set1_epi32(0xFFFF));
+    const __m256i step = _mm256_srai_epi32(record, 16);
+    const __m256i offset = _mm256_mullo_epi32(step, _mm256_and_si256(index, _mm256_set1_epi32(compactMask)));
+    const __m256i line = _mm256_add_epi32(base, _mm256_srai_epi32(_mm256_add_epi32(offset, _mm256_set1_epi32(1 << (compactShift - 1))), compactShift));
+
+    const __m256i packed = _mm256_i32gather_epi32(corrections, _mm256_srli_epi32(index, 1), 1);
+    const __m256i shift = _mm256_slli_epi32(_mm256_and_si256(index, _mm256_set1_epi32(1)), 2);
+    const __m256i nibble = _mm256_and_si256(_mm256_srlv_epi32(packed, shift), _mm256_set1_epi32(15));
+    const __m256i correction = _mm256_sub_epi32(_mm256_xor_si256(nibble, _mm256_set1_epi32(8)), _mm256_set1_epi32(8));
+
+    return _mm256_add_epi32(line, correction);
+}
+
+template<bool stream>
+void filter_compact_avx2(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _lut) noexcept {
+    const uint16_t * srcp = static_cast<const uint16_t *>(_srcp);
+    uint16_t * VS_RESTRICT dstp = static_cast<uint16_t *>(_dstp);
+    const uint16_t * lut = static_cast<const uint16_t *>(_lut);
+    const int * records = reinterpret_cast<const int *>(lut + 2);
+    const int * corrections = reinterpret_cast<const int *>(lut + 2 + lut[0] * 2);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = decodeCompact(lut, srcp[x]);
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+            const __m256i lo = _mm256_and_si256(decode(_mm256_unpacklo_epi16(src, zero), records, corrections), mask);
+            const __m256i hi = _mm256_and_si256(decode(_mm256_unpackhi_epi16(src, zero), records, corrections), mask);
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm256_packus_epi32(lo, hi));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = decodeCompact(lut, srcp[x]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+static inline __m128i evaluate(const __m128i x, const __m128i index, const CubicSpline * spline, const __m256d invScale, const __m256d scale) noexcept {
+    const __m256d t = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(x), _mm256_i32gather_pd(spline->start, index, 8)), invScale);
+    __m256d y = _mm256_fmadd_pd(_mm256_i32gather_pd(spline->d, index, 8), t, _mm256_i32gather_pd(spline->c, index, 8));
+    y = _mm256_fmadd_pd(y, t, _mm256_i32gather_pd(spline->b, index, 8));
+    y = _mm256_fmadd_pd(y, t, _mm256_i32gather_pd(spline->a, index, 8));
+    return _mm256_cvttpd_epi32(_mm256_fmadd_pd(y, scale, _mm256_set1_pd(0.5)));
+}
+
+/**
+ * Evaluates the spline directly. The segment of each sample is found by counting the knots it has reached,
+ * and its coefficients are gathered from the spline, which is small enough to stay in L1.
+ */
+template<bool stream>
+void filter_cubic_avx2(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _spline) noexcept {
+    const uint16_t * srcp = static_cast<const uint16_t *>(_srcp);
+    uint16_t * VS_RESTRICT dstp = static_cast<uint16_t *>(_dstp);
+    const CubicSpline * spline = static_cast<const CubicSpline *>(_spline);
+
+    __m256i knot[CubicSpline::maxSegments];
+    for (int k = 1; k < spline->numSegments; k++)
+        knot[k] = _mm256_set1_epi32(spline->knot[k] - 1);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i first = _mm256_set1_epi32(spline->knot[0]);
+    const __m256i peak = _mm256_set1_epi32(spline->scale);
+    const __m256d invScale = _mm256_set1_pd(1.0 / spline->scale);
+    const __m256d scale = _mm256_set1_pd(spline->scale);
+
+    const auto process = [&](const __m256i src) {
+        const __m256i x = _mm256_max_epi32(src, first);
+        __m256i index = zero;
+        for (int k = 1; k < spline->numSegments; k++)
+            index = _mm256_sub_epi32(index, _mm256_cmpgt_epi32(x, knot[k]));
+
+        const __m128i lo = evaluate(_mm256_castsi256_si128(x), _mm256_castsi256_si128(index), spline, invScale, scale);
+        const __m128i hi = evaluate(_mm256_extracti128_si256(x, 1), _mm256_extracti128_si256(index, 1), spline, invScale, scale);
+        return _mm256_min_epi32(_mm256_max_epi32(_mm256_setr_m128i(lo, hi), zero), peak);
+    };
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = evaluateCubic(spline, srcp[x]);
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+            const __m256i lo = process(_mm256_unpacklo_epi16(src, zero));
+            const __m256i hi = process(_mm256_unpackhi_epi16(src, zero));
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm256_packus_epi32(lo, hi));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = evaluateCubic(spline, srcp[x]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<bool stream>
+static void affine(const uint8_t * srcp, uint8_t * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const AffineMap * map) noexcept {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_set1_epi32(map->lo);
+    const __m256i hi = _mm256_set1_epi32(map->hi);
+    const __m256i mul = _mm256_set1_epi32(map->mul);
+    const __m256i add = _mm256_set1_epi32(map->add);
+    const __m128i shift = _mm_cvtsi32_si128(map->shift);
+
+    const auto evaluate = [&](const __m256i x) {
+        const __m256i offset = _mm256_sub_epi32(_mm256_min_epi32(_mm256_max_epi32(x, lo), hi), lo);
+        return _mm256_sra_epi32(_mm256_add_epi32(_mm256_mullo_epi32(offset, mul), add), shift);
+    };
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~31);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<uint8_t>(evaluateAffine(map, srcp[x]));
+
+        for (int x = head; x < widthSimd; x += 32) {
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+            const __m256i lo16 = _mm256_unpacklo_epi8(src, zero);
+            const __m256i hi16 = _mm256_unpackhi_epi8(src, zero);
+
+            // every unpack is undone by the pack in the same lane, so the sample order is preserved
+            const __m256i resultLo = _mm256_packus_epi32(evaluate(_mm256_unpacklo_epi16(lo16, zero)), evaluate(_mm256_unpackhi_epi16(lo16, zero)));
+            const __m256i resultHi = _mm256_packus_epi32(evaluate(_mm256_unpacklo_epi16(hi16, zero)), evaluate(_mm256_unpackhi_epi16(hi16, zero)));
+            store<stream>(dstp + x, _mm256_packus_epi16(resultLo, resultHi));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<uint8_t>(evaluateAffine(map, srcp[x]));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<bool stream>
+static void affine(const uint16_t * srcp, uint16_t * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const AffineMap * map) noexcept {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_set1_epi32(map->lo);
+    const __m256i hi = _mm256_set1_epi32(map->hi);
+    const __m256i mul = _mm256_set1_epi32(map->mul);
+    const __m256i add = _mm256_set1_epi32(map->add);
+    const __m128i shift = _mm_cvtsi32_si128(map->shift);
+
+    const auto evaluate = [&](const __m256i x) {
+        const __m256i offset = _mm256_sub_epi32(_mm256_min_epi32(_mm256_max_epi32(x, lo), hi), lo);
+        return _mm256_sra_epi32(_mm256_add_epi32(_mm256_mullo_epi32(offset, mul), add), shift);
+    };
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<uint16_t>(evaluateAffine(map, srcp[x]));
+
+        for (int x = head; x < widthSimd; x += 16) {
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+            const __m256i lo32 = evaluate(_mm256_unpacklo_epi16(src, zero));
+            const __m256i hi32 = evaluate(_mm256_unpackhi_epi16(src, zero));
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm256_packus_epi32(lo32, hi32));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<uint16_t>(evaluateAffine(map, srcp[x]));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<typename T, bool stream>
+void filter_affine_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept {
+    affine<stream>(static_cast<const T *>(srcp), static_cast<T *>(dstp), width, height, srcStride, dstStride, static_cast<const AffineMap *>(map));
+}
+
+/**
+ * Inputs never exceed the scale, which has all of its bits set, so subtracting from it is the same as flipping them.
+ */
+template<typename T, bool stream>
+void filter_invert_avx2(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _map) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    T * VS_RESTRICT dstp = static_cast<T *>(_dstp);
+    const AffineMap * map = static_cast<const AffineMap *>(_map);
+
+    const __m256i scale = sizeof(T) == 1 ? _mm256_set1_epi8(static_cast<char>(map->hi)) : _mm256_set1_epi16(static_cast<short>(map->hi));
+    constexpr int step = 32 / sizeof(T);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~(step - 1));
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<T>(map->hi - srcp[x]);
+
+        for (int x = head; x < widthSimd; x += step) {
+            const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x));
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm256_xor_si256(src, scale));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<T>(map->hi - srcp[x]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+static inline __m256 loadFloat(const float * srcp) noexcept {
+    return _mm256_loadu_ps(srcp);
+}
+
+static inline __m256 loadFloat(const uint16_t * srcp) noexcept {
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(srcp)));
+}
+
+template<bool stream>
+static inline void storeFloat(float * dstp, const __m256 x) noexcept {
+    store<stream>(reinterpret_cast<uint8_t *>(dstp), _mm256_castps_si256(x));
+}
+
+template<bool stream>
+static inline void storeFloat(uint16_t * dstp, const __m256 x) noexcept {
+    const __m128i half = _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+
+    if (stream)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dstp), half);
+    else
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dstp), half);
+}
+
+/**
+ * Evaluates the splines of a float plane. The segment of each sample is found by counting the starts it has reached,
+ * and the coefficients are permuted from registers when the spline has at most eight segments, or gathered otherwise.
+ * Half precision samples are converted with F16C on the way in and out.
+ */
+template<typename T, typename U, bool stream>
+void filter_float_avx2(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _curve) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const FloatCurve * curve = static_cast<const FloatCurve *>(_curve);
+
+    __m256 table[2][5];
+    for (int i = 0; i < 2; i++) {
+        const FloatSpline & spline = curve->spline[i];
+        if (spline.numSegments && spline.numSegments <= 8) {
+            const std::vector<float> * coefficients[] = { &spline.start, &spline.a, &spline.b, &spline.c, &spline.d };
+            for (int j = 0; j < 5; j++) {
+                alignas(32) float buffer[8] = {};
+                std::copy(coefficients[j]->begin(), coefficients[j]->end(), buffer);
+                table[i][j] = _mm256_load_ps(buffer);
+            }
+        }
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 offset = _mm256_set1_ps(curve->offset);
+
+    const auto evaluate = [&](__m256 x, const int i) {
+        const FloatSpline & spline = curve->spline[i];
+        if (!spline.numSegments)
+            return x;
+
+        x = _mm256_max_ps(x, _mm256_broadcast_ss(spline.start.data()));
+        __m256i index = _mm256_setzero_si256();
+        for (int k = 1; k < spline.numSegments; k++)
+            index = _mm256_sub_epi32(index, _mm256_castps_si256(_mm256_cmp_ps(x, _mm256_broadcast_ss(&spline.start[k]), _CMP_GE_OQ)));
+
+        const auto fetch = [&](const int j, const std::vector<float> & coefficient) {
+            return spline.numSegments <= 8 ? _mm256_permutevar8x32_ps(table[i][j], index) : _mm256_i32gather_ps(coefficient.data(), index, 4);
+        };
+
+        const __m256 t = _mm256_sub_ps(x, fetch(0, spline.start));
+        __m256 y = _mm256_fmadd_ps(fetch(4, spline.d), t, fetch(3, spline.c));
+        y = _mm256_fmadd_ps(y, t, fetch(2, spline.b));
+        y = _mm256_fmadd_ps(y, t, fetch(1, spline.a));
+        return _mm256_min_ps(_mm256_max_ps(y, zero), one);
+    };
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, sizeof(U) * 8) : 0;
+        const int widthSimd = head + ((width - head) & ~7);
+
+        for (int x = 0; x < head; x++)
+            fromFloat(dstp + x, evaluateFloat<true>(curve, toFloat(srcp[x])));
+
+        for (int x = head; x < widthSimd; x += 8) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m256 src = _mm256_add_ps(loadFloat(srcp + x), offset);
+            storeFloat<stream>(dstp + x, _mm256_sub_ps(evaluate(evaluate(src, 0), 1), offset));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            fromFloat(dstp + x, evaluateFloat<true>(curve, toFloat(srcp[x])));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+static inline void loadIndices(const uint8_t * srcp, __m256i & lo, __m256i & hi) noexcept {
+    const __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i *>(srcp));
+    lo = _mm256_cvtepu8_epi32(src);
+    hi = _mm256_cvtepu8_epi32(_mm_srli_si128(src, 8));
+}
+
+static inline void loadIndices(const uint16_t * srcp, __m256i & lo, __m256i & hi) noexcept {
+    const __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp));
+    lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(src));
+    hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(src, 1));
+}
+
+static inline __m256i gather(const uint16_t * graph, const __m256i index) noexcept {
+    return _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int *>(graph), index, 2), _mm256_set1_epi32(0xFFFF));
+}
+
+static inline __m256i gather(const float * graph, const __m256i index) noexcept {
+    return _mm256_castps_si256(_mm256_i32gather_ps(graph, index, 4));
+}
+
+template<bool stream>
+static inline void storeConverted(uint8_t * dstp, const __m256i lo, const __m256i hi) noexcept {
+    const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+    const __m128i bytes = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(words, _mm256_setzero_si256()), 0x08));
+
+    if (stream)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dstp), bytes);
+    else
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dstp), bytes);
+}
+
+template<bool stream>
+static inline void storeConverted(uint16_t * dstp, const __m256i lo, const __m256i hi) noexcept {
+    store<stream>(reinterpret_cast<uint8_t *>(dstp), _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8));
+}
+
+template<bool stream>
+static inline void storeConverted(float * dstp, const __m256i lo, const __m256i hi) noexcept {
+    store<stream>(reinterpret_cast<uint8_t *>(dstp), lo);
+    store<stream>(reinterpret_cast<uint8_t *>(dstp + 8), hi);
+}
+
+/**
+ * Lookup whose output differs in size from the input, from a LUT of uint16_t for integer or half precision output
+ * and of float for single precision output. The LUT entries are gathered as 32 bits.
+ */
+template<typename T, typename U, bool stream>
+void filter_convert_avx2(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _graph) noexcept {
+    using G = typename std::conditional<std::is_same<U, float>::value, float, uint16_t>::type;
+
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const G * graph = static_cast<const G *>(_graph);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, std::min<int>(sizeof(U) * 16, 32)) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<U>(graph[srcp[x]]);
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            __m256i lo, hi;
+            loadIndices(srcp + x, lo, hi);
+            storeConverted<stream>(dstp + x, gather(graph, lo), gather(graph, hi));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<U>(graph[srcp[x]]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+/**
+ * Lookup with ordered dithering. The thresholds repeat every 8 columns, so both halves of 16 samples add the same 8.
+ */
+template<typename T, typename U, bool stream>
+void filter_dither_avx2(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _map) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const DitherMap * map = static_cast<const DitherMap *>(_map);
+    const uint16_t * graph = map->graph;
+    const __m128i shift = _mm_cvtsi32_si128(map->shift);
+
+    for (int y = 0; y < height; y++) {
+        const uint16_t * threshold = map->threshold[y & 7];
+        const int head = stream ? getStreamHead(dstp, width, sizeof(U) * 16) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<U>((graph[srcp[x]] + threshold[x & 7]) >> map->shift);
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m256i t = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(threshold + (x & 7))));
+            __m256i lo, hi;
+            loadIndices(srcp + x, lo, hi);
+            lo = _mm256_srl_epi32(_mm256_add_epi32(gather(graph, lo), t), shift);
+            hi = _mm256_srl_epi32(_mm256_add_epi32(gather(graph, hi), t), shift);
+            storeConverted<stream>(dstp + x, lo, hi);
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<U>((graph[srcp[x]] + threshold[x & 7]) >> map->shift);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<typename T, bool stream>
+void filter_avx2(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept {
+    lookup<stream>(static_cast<const T *>(srcp), static_cast<T *>(dstp), width, height, srcStride, dstStride, static_cast<const uint16_t *>(graph));
+}
+
+template void filter_avx2<uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx2<uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx2<uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx2<uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+
+template void filter_compact_avx2<false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut) noexcept;
+template void filter_compact_avx2<true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut) noexcept;
+
+template void filter_cubic_avx2<false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * spline) noexcept;
+template void filter_cubic_avx2<true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * spline) noexcept;
+
+template void filter_affine_avx2<uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_affine_avx2<uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_affine_avx2<uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_affine_avx2<uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+
+template void filter_invert_avx2<uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_invert_avx2<uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_invert_avx2<uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_invert_avx2<uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+
+template void filter_convert_avx2<uint8_t, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint8_t, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint8_t, float, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint8_t, float, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint16_t, uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint16_t, uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint16_t, float, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_convert_avx2<uint16_t, float, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+
+template void filter_dither_avx2<uint8_t, uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint8_t, uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint8_t, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint8_t, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint16_t, uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint16_t, uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint16_t, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+template void filter_dither_avx2<uint16_t, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * map) noexcept;
+
+template void filter_float_avx2<uint16_t, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<uint16_t, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<uint16_t, float, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<uint16_t, float, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<float, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<float, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<float, float, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx2<float, float, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+#endif
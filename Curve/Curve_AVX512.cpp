@@ -0,0 +1,335 @@
+#ifdef CURVE_X86
+#include <immintrin.h>
+
+#include "Curve.h"
+
+template<bool stream>
+static inline void store(uint8_t * dstp, const __m512i x) noexcept {
+    if (stream)
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(dstp), x);
+    else
+        _mm512_storeu_si512(dstp, x);
+}
+
+/**
+ * Same nibble-split lookup as the AVX2 kernel, for CPUs without VBMI.
+ */
+template<bool stream>
+static void lookup(const uint8_t * srcp, uint8_t * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const uint16_t * graph) noexcept {
+    __m512i table[16];
+    for (int i = 0; i < 16; i++)
+        table[i] = _mm512_broadcast_i32x4(_mm_packus_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(graph + i * 16)),
+                                                           _mm_loadu_si128(reinterpret_cast<const __m128i *>(graph + i * 16 + 8))));
+
+    const __m512i bias = _mm512_set1_epi8(0x70);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 64) : 0;
+        const int widthSimd = head + ((width - head) & ~63);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<uint8_t>(graph[srcp[x]]);
+
+        for (int x = head; x < widthSimd; x += 64) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m512i src = _mm512_loadu_si512(srcp + x);
+            __m512i result = _mm512_shuffle_epi8(table[0], _mm512_adds_epu8(src, bias));
+
+            for (int i = 1; i < 16; i++) {
+                const __m512i index = _mm512_adds_epu8(_mm512_xor_si512(src, _mm512_set1_epi8(static_cast<char>(i << 4))), bias);
+                result = _mm512_or_si512(result, _mm512_shuffle_epi8(table[i], index));
+            }
+
+            store<stream>(dstp + x, result);
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<uint8_t>(graph[srcp[x]]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<bool stream>
+static void lookup(const uint16_t * srcp, uint16_t * VS_RESTRICT dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const uint16_t * graph) noexcept {
+    const int * table = reinterpret_cast<const int *>(graph);
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 64) : 0;
+        const int widthSimd = head + ((width - head) & ~31);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = graph[srcp[x]];
+
+        for (int x = head; x < widthSimd; x += 32) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x)));
+            const __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x + 16)));
+
+            // the narrowing conversion truncates, which drops the neighbouring entry fetched by each 32-bit gather
+            const __m256i resultLo = _mm512_cvtepi32_epi16(_mm512_i32gather_epi32(lo, table, 2));
+            const __m256i resultHi = _mm512_cvtepi32_epi16(_mm512_i32gather_epi32(hi, table, 2));
+
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm512_inserti64x4(_mm512_castsi256_si512(resultLo), resultHi, 1));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = graph[srcp[x]];
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+static inline __m512i decode(const __m512i index, const void * records, const void * corrections) noexcept {
+    const __m512i record = _mm512_i32gather_epi32(_mm512_srli_epi32(index, compactShift), records, 4);
+    const __m512i base = _mm512_and_si512(record, _mm512_set1_epi32(0xFFFF));
+    const __m512i step = _mm512_srai_epi32(record, 16);
+    const __m512i offset = _mm512_mullo_epi32(step, _mm512_and_si512(index, _mm512_set1_epi32(compactMask)));
+    const __m512i line = _mm512_add_epi32(base, _mm512_srai_epi32(_mm512_add_epi32(offset, _mm512_set1_epi32(1 << (compactShift - 1))), compactShift));
+
+    const __m512i packed = _mm512_i32gather_epi32(_mm512_srli_epi32(index, 1), corrections, 1);
+    const __m512i shift = _mm512_slli_epi32(_mm512_and_si512(index, _mm512_set1_epi32(1)), 2);
+    const __m512i nibble = _mm512_and_si512(_mm512_srlv_epi32(packed, shift), _mm512_set1_epi32(15));
+    const __m512i correction = _mm512_sub_epi32(_mm512_xor_si512(nibble, _mm512_set1_epi32(8)), _mm512_set1_epi32(8));
+
+    return _mm512_add_epi32(line, correction);
+}
+
+template<bool stream>
+void filter_compact_avx512(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _lut) noexcept {
+    const uint16_t * srcp = static_cast<const uint16_t *>(_srcp);
+    uint16_t * VS_RESTRICT dstp = static_cast<uint16_t *>(_dstp);
+    const uint16_t * lut = static_cast<const uint16_t *>(_lut);
+    const uint16_t * records = lut + 2;
+    const uint16_t * corrections = lut + 2 + lut[0] * 2;
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 64) : 0;
+        const int widthSimd = head + ((width - head) & ~31);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = decodeCompact(lut, srcp[x]);
+
+        for (int x = head; x < widthSimd; x += 32) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x)));
+            const __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x + 16)));
+            const __m256i resultLo = _mm512_cvtepi32_epi16(decode(lo, records, corrections));
+            const __m256i resultHi = _mm512_cvtepi32_epi16(decode(hi, records, corrections));
+            store<stream>(reinterpret_cast<uint8_t *>(dstp + x), _mm512_inserti64x4(_mm512_castsi256_si512(resultLo), resultHi, 1));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = decodeCompact(lut, srcp[x]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+/**
+ * Evaluates the spline directly. The segment of each sample is found by counting the knots it has reached,
+ * and its coefficients are picked from registers with two-table permutes.
+ */
+template<bool stream>
+void filter_cubic_avx512(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _spline) noexcept {
+    const uint16_t * srcp = static_cast<const uint16_t *>(_srcp);
+    uint16_t * VS_RESTRICT dstp = static_cast<uint16_t *>(_dstp);
+    const CubicSpline * spline = static_cast<const CubicSpline *>(_spline);
+
+    __m512i knot[CubicSpline::maxSegments];
+    for (int k = 1; k < spline->numSegments; k++)
+        knot[k] = _mm512_set1_epi32(spline->knot[k]);
+
+    const __m512d start[] = { _mm512_loadu_pd(spline->start), _mm512_loadu_pd(spline->start + 8) };
+    const __m512d a[] = { _mm512_loadu_pd(spline->a), _mm512_loadu_pd(spline->a + 8) };
+    const __m512d b[] = { _mm512_loadu_pd(spline->b), _mm512_loadu_pd(spline->b + 8) };
+    const __m512d c[] = { _mm512_loadu_pd(spline->c), _mm512_loadu_pd(spline->c + 8) };
+    const __m512d d[] = { _mm512_loadu_pd(spline->d), _mm512_loadu_pd(spline->d + 8) };
+
+    const __m512i first = _mm512_set1_epi32(spline->knot[0]);
+    const __m512i peak = _mm512_set1_epi32(spline->scale);
+    const __m512d invScale = _mm512_set1_pd(1.0 / spline->scale);
+    const __m512d scale = _mm512_set1_pd(spline->scale);
+
+    const auto evaluate = [&](const __m256i x, const __m256i index) {
+        const __m512i i = _mm512_cvtepi32_epi64(index);
+        const __m512d t = _mm512_mul_pd(_mm512_sub_pd(_mm512_cvtepi32_pd(x), _mm512_permutex2var_pd(start[0], i, start[1])), invScale);
+        __m512d y = _mm512_fmadd_pd(_mm512_permutex2var_pd(d[0], i, d[1]), t, _mm512_permutex2var_pd(c[0], i, c[1]));
+        y = _mm512_fmadd_pd(y, t, _mm512_permutex2var_pd(b[0], i, b[1]));
+        y = _mm512_fmadd_pd(y, t, _mm512_permutex2var_pd(a[0], i, a[1]));
+        return _mm512_cvttpd_epi32(_mm512_fmadd_pd(y, scale, _mm512_set1_pd(0.5)));
+    };
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 32) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = evaluateCubic(spline, srcp[x]);
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m512i src = _mm512_max_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp + x))), first);
+            __m512i index = _mm512_setzero_si512();
+            for (int k = 1; k < spline->numSegments; k++)
+                index = _mm512_mask_add_epi32(index, _mm512_cmpge_epi32_mask(src, knot[k]), index, _mm512_set1_epi32(1));
+
+            const __m256i lo = evaluate(_mm512_castsi512_si256(src), _mm512_castsi512_si256(index));
+            const __m256i hi = evaluate(_mm512_extracti64x4_epi64(src, 1), _mm512_extracti64x4_epi64(index, 1));
+            const __m512i result = _mm512_min_epi32(_mm512_max_epi32(_mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1), _mm512_setzero_si512()), peak);
+
+            if (stream)
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dstp + x), _mm512_cvtepi32_epi16(result));
+            else
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp + x), _mm512_cvtepi32_epi16(result));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = evaluateCubic(spline, srcp[x]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+static inline __m512 loadFloat(const float * srcp) noexcept {
+    return _mm512_loadu_ps(srcp);
+}
+
+static inline __m512 loadFloat(const uint16_t * srcp) noexcept {
+    return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(srcp)));
+}
+
+template<bool stream>
+static inline void storeFloat(float * dstp, const __m512 x) noexcept {
+    store<stream>(reinterpret_cast<uint8_t *>(dstp), _mm512_castps_si512(x));
+}
+
+template<bool stream>
+static inline void storeFloat(uint16_t * dstp, const __m512 x) noexcept {
+    const __m256i half = _mm512_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+
+    if (stream)
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dstp), half);
+    else
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dstp), half);
+}
+
+/**
+ * Same as the AVX2 float kernel, with the coefficients of splines of up to 16 segments permuted from registers.
+ */
+template<typename T, typename U, bool stream>
+void filter_float_avx512(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _curve) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const FloatCurve * curve = static_cast<const FloatCurve *>(_curve);
+
+    __m512 table[2][5];
+    for (int i = 0; i < 2; i++) {
+        const FloatSpline & spline = curve->spline[i];
+        if (spline.numSegments && spline.numSegments <= 16) {
+            const std::vector<float> * coefficients[] = { &spline.start, &spline.a, &spline.b, &spline.c, &spline.d };
+            for (int j = 0; j < 5; j++)
+                table[i][j] = _mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << spline.numSegments) - 1), coefficients[j]->data());
+        }
+    }
+
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 offset = _mm512_set1_ps(curve->offset);
+
+    const auto evaluate = [&](__m512 x, const int i) {
+        const FloatSpline & spline = curve->spline[i];
+        if (!spline.numSegments)
+            return x;
+
+        x = _mm512_max_ps(x, _mm512_set1_ps(spline.start[0]));
+        __m512i index = _mm512_setzero_si512();
+        for (int k = 1; k < spline.numSegments; k++)
+            index = _mm512_mask_add_epi32(index, _mm512_cmp_ps_mask(x, _mm512_set1_ps(spline.start[k]), _CMP_GE_OQ), index, _mm512_set1_epi32(1));
+
+        const auto fetch = [&](const int j, const std::vector<float> & coefficient) {
+            return spline.numSegments <= 16 ? _mm512_permutexvar_ps(index, table[i][j]) : _mm512_i32gather_ps(index, coefficient.data(), 4);
+        };
+
+        const __m512 t = _mm512_sub_ps(x, fetch(0, spline.start));
+        __m512 y = _mm512_fmadd_ps(fetch(4, spline.d), t, fetch(3, spline.c));
+        y = _mm512_fmadd_ps(y, t, fetch(2, spline.b));
+        y = _mm512_fmadd_ps(y, t, fetch(1, spline.a));
+        return _mm512_min_ps(_mm512_max_ps(y, zero), one);
+    };
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, sizeof(U) * 16) : 0;
+        const int widthSimd = head + ((width - head) & ~15);
+
+        for (int x = 0; x < head; x++)
+            fromFloat(dstp + x, evaluateFloat<true>(curve, toFloat(srcp[x])));
+
+        for (int x = head; x < widthSimd; x += 16) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m512 src = _mm512_add_ps(loadFloat(srcp + x), offset);
+            storeFloat<stream>(dstp + x, _mm512_sub_ps(evaluate(evaluate(src, 0), 1), offset));
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            fromFloat(dstp + x, evaluateFloat<true>(curve, toFloat(srcp[x])));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template<typename T, bool stream>
+void filter_avx512(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept {
+    lookup<stream>(static_cast<const T *>(srcp), static_cast<T *>(dstp), width, height, srcStride, dstStride, static_cast<const uint16_t *>(graph));
+}
+
+template void filter_avx512<uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx512<uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx512<uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx512<uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+
+template void filter_compact_avx512<false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut) noexcept;
+template void filter_compact_avx512<true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * lut) noexcept;
+
+template void filter_cubic_avx512<false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * spline) noexcept;
+template void filter_cubic_avx512<true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * spline) noexcept;
+
+template void filter_float_avx512<uint16_t, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<uint16_t, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<uint16_t, float, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<uint16_t, float, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<float, uint16_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<float, uint16_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<float, float, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+template void filter_float_avx512<float, float, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * curve) noexcept;
+#endif
@@ -0,0 +1,58 @@
+#ifdef CURVE_X86
+#include <immintrin.h>
+
+#include "Curve.h"
+
+/**
+ * 8-bit lookup with the whole table held in four registers. Each vpermi2b covers 128 entries using the
+ * low seven bits of the index, and the top bit of the source picks between the two halves.
+ */
+template<typename T, bool stream>
+void filter_avx512vbmi(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _graph) noexcept {
+    const uint8_t * srcp = static_cast<const uint8_t *>(_srcp);
+    uint8_t * VS_RESTRICT dstp = static_cast<uint8_t *>(_dstp);
+    const uint16_t * graph = static_cast<const uint16_t *>(_graph);
+
+    __m512i table[4];
+    for (int i = 0; i < 4; i++) {
+        const __m512i lo = _mm512_loadu_si512(graph + i * 64);
+        const __m512i hi = _mm512_loadu_si512(graph + i * 64 + 32);
+        table[i] = _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), _mm512_packus_epi16(lo, hi));
+    }
+
+    for (int y = 0; y < height; y++) {
+        const int head = stream ? getStreamHead(dstp, width, 64) : 0;
+        const int widthSimd = head + ((width - head) & ~63);
+
+        for (int x = 0; x < head; x++)
+            dstp[x] = static_cast<uint8_t>(graph[srcp[x]]);
+
+        for (int x = head; x < widthSimd; x += 64) {
+            if (stream)
+                _mm_prefetch(reinterpret_cast<const char *>(srcp + x + srcStride * prefetchRows), _MM_HINT_T0);
+
+            const __m512i src = _mm512_loadu_si512(srcp + x);
+            const __m512i lo = _mm512_permutex2var_epi8(table[0], src, table[1]);
+            const __m512i hi = _mm512_permutex2var_epi8(table[2], src, table[3]);
+            const __m512i result = _mm512_mask_blend_epi8(_mm512_movepi8_mask(src), lo, hi);
+
+            if (stream)
+                _mm512_stream_si512(reinterpret_cast<__m512i *>(dstp + x), result);
+            else
+                _mm512_storeu_si512(dstp + x, result);
+        }
+
+        for (int x = widthSimd; x < width; x++)
+            dstp[x] = static_cast<uint8_t>(graph[srcp[x]]);
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+
+    if (stream)
+        _mm_sfence();
+}
+
+template void filter_avx512vbmi<uint8_t, false>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+template void filter_avx512vbmi<uint8_t, true>(const void * srcp, void * dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * graph) noexcept;
+#endif
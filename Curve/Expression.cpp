@@ -0,0 +1,148 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <locale>
+#include <sstream>
+#include <utility>
+
+#include "Expression.h"
+
+Expression::Expression(const std::string & source) {
+    static const struct {
+        const char * name;
+        Opcode opcode;
+        int operands;
+    } operators[] = {
+        { "x", opX, 0 }, { "pi", opConstant, 0 },
+        { "+", opAdd, 2 }, { "-", opSub, 2 }, { "*", opMul, 2 }, { "/", opDiv, 2 },
+        { "max", opMax, 2 }, { "min", opMin, 2 }, { "pow", opPow, 2 },
+        { ">", opGt, 2 }, { "<", opLt, 2 }, { "=", opEq, 2 }, { ">=", opGe, 2 }, { "<=", opLe, 2 },
+        { "and", opAnd, 2 }, { "or", opOr, 2 }, { "xor", opXor, 2 },
+        { "exp", opExp, 1 }, { "log", opLog, 1 }, { "sqrt", opSqrt, 1 }, { "abs", opAbs, 1 }, { "not", opNot, 1 },
+        { "?", opTernary, 3 },
+    };
+
+    std::istringstream tokens{ source };
+    std::string token;
+    int depth = 0;
+
+    while (tokens >> token) {
+        Instruction instruction = { opConstant, 0, 0.0 };
+        int required = -1, pushed = 1;
+
+        for (const auto & op : operators) {
+            if (token == op.name) {
+                instruction.opcode = op.opcode;
+                required = op.operands;
+                pushed = 1 - op.operands;
+                if (token == "pi")
+                    instruction.value = 3.14159265358979323846;
+            }
+        }
+
+        // dupN copies the value N below the top, and swapN exchanges the top with it, so dup and swap are dup0 and swap1
+        const bool dup = !token.compare(0, 3, "dup"), swap = !token.compare(0, 4, "swap");
+        if (required < 0 && (dup || swap)) {
+            const std::string suffix = token.substr(dup ? 3 : 4);
+            if (suffix.find_first_not_of("0123456789") == std::string::npos && suffix.size() < 3) {
+                instruction.opcode = dup ? opDup : opSwap;
+                instruction.distance = suffix.empty() ? !dup : std::atoi(suffix.c_str());
+                required = instruction.distance + 1;
+                pushed = dup;
+            }
+        }
+
+        if (required < 0) {
+            std::istringstream number{ token };
+            number.imbue(std::locale::classic());
+            if (!(number >> instruction.value) || !number.eof())
+                throw std::string{ "invalid token " } + token + " in expr";
+            required = 0;
+        }
+
+        if (depth < required)
+            throw std::string{ "expr needs more values on the stack for " } + token;
+
+        depth += pushed;
+        if (depth > maxDepth)
+            throw std::string{ "expr uses too many values on the stack" };
+
+        program.push_back(instruction);
+    }
+
+    if (depth != 1)
+        throw std::string{ "expr must leave exactly one value on the stack" };
+}
+
+double Expression::operator()(const double x) const noexcept {
+    double stack[maxDepth];
+    double * top = stack - 1;
+
+    for (const Instruction & instruction : program) {
+        switch (instruction.opcode) {
+        case opConstant:
+            *++top = instruction.value;
+            break;
+        case opX:
+            *++top = x;
+            break;
+        case opDup:
+            top[1] = top[-instruction.distance];
+            top++;
+            break;
+        case opSwap:
+            std::swap(top[0], top[-instruction.distance]);
+            break;
+        case opExp:
+            top[0] = std::exp(top[0]);
+            break;
+        case opLog:
+            top[0] = std::log(top[0]);
+            break;
+        case opSqrt:
+            top[0] = std::sqrt(top[0]);
+            break;
+        case opAbs:
+            top[0] = std::abs(top[0]);
+            break;
+        case opNot:
+            top[0] = top[0] > 0.0 ? 0.0 : 1.0;
+            break;
+        case opTernary:
+            top -= 2;
+            top[0] = top[0] > 0.0 ? top[1] : top[2];
+            break;
+        default: {
+            const double a = top[-1], b = top[0];
+            double & result = *--top;
+
+            switch (instruction.opcode) {
+            case opAdd: result = a + b; break;
+            case opSub: result = a - b; break;
+            case opMul: result = a * b; break;
+            case opDiv: result = a / b; break;
+            case opMax: result = std::max(a, b); break;
+            case opMin: result = std::min(a, b); break;
+            case opPow: result = std::pow(a, b); break;
+            case opGt: result = a > b; break;
+            case opLt: result = a < b; break;
+            case opEq: result = a == b; break;
+            case opGe: result = a >= b; break;
+            case opLe: result = a <= b; break;
+            case opAnd: result = a > 0.0 && b > 0.0; break;
+            case opOr: result = a > 0.0 || b > 0.0; break;
+            case opXor: result = (a > 0.0) != (b > 0.0); break;
+            default: break;
+            }
+        }
+        }
+    }
+
+    // NaN is tested on the bits, since -ffast-math folds the comparisons that would catch it
+    uint64_t bits;
+    std::memcpy(&bits, top, sizeof(bits));
+    return (bits & ~(uint64_t{ 1 } << 63)) > uint64_t{ 0x7FF0000000000000 } ? 0.0 : top[0];
+}
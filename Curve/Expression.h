@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * Tone function written in reverse polish notation with the operators of std.Expr, where x is the sample scaled to [0;1].
+ * It is compiled once and evaluated with double precision for every LUT entry, so its cost does not depend on the clip.
+ * Values greater than 0 are true, and comparisons return 1 or 0. A result of NaN, e.g. the root of a negative value,
+ * evaluates to 0.
+ */
+class Expression {
+public:
+    /**
+     * Throws a std::string describing the first token that cannot be compiled.
+     */
+    explicit Expression(const std::string & source);
+
+    double operator()(const double x) const noexcept;
+
+private:
+    enum Opcode {
+        opConstant, opX, opDup, opSwap,
+        opAdd, opSub, opMul, opDiv, opMax, opMin, opPow,
+        opGt, opLt, opEq, opGe, opLe, opAnd, opOr, opXor,
+        opExp, opLog, opSqrt, opAbs, opNot,
+        opTernary,
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        int distance; // from the top of the stack for dup and swap
+        double value;
+    };
+
+    static constexpr int maxDepth = 64;
+
+    std::vector<Instruction> program;
+};
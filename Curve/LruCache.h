@@ -0,0 +1,66 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Thread-safe cache of shared values keyed by strings, which keeps up to a fixed number of them and drops the least
+ * recently used one beyond that. A dropped value stays alive for as long as a caller still holds it.
+ */
+template<typename T>
+class LruCache {
+public:
+    explicit LruCache(const size_t capacity) : capacity(capacity) {}
+
+    std::shared_ptr<const T> find(const std::string & key) {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        const auto it = index.find(key);
+        if (it == index.end())
+            return nullptr;
+
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    /**
+     * Caches value unless another caller got there first with the same key, and returns the cached value either way.
+     */
+    std::shared_ptr<const T> insert(const std::string & key, std::shared_ptr<const T> value) {
+        std::lock_guard<std::mutex> lock{ mutex };
+
+        const auto it = index.find(key);
+        if (it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+
+        entries.emplace_front(key, std::move(value));
+        index.emplace(key, entries.begin());
+
+        if (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+
+        return entries.front().second;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock{ mutex };
+        entries.clear();
+        index.clear();
+    }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const T>>;
+
+    const size_t capacity;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+    std::mutex mutex;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Process-wide store that lets the planes and the instances of the filter share equal LUTs, e.g. when a script creates
+ * the same curve many times. Tables are found by a hash of their contents rather than of the parameters they were made
+ * from, since many of those end up in them. A table stays in the store only for as long as someone holds it.
+ */
+template<typename T>
+class LutStore {
+public:
+    /**
+     * Returns the stored table equal to the first size entries of table, storing table if there is none yet.
+     */
+    static std::shared_ptr<const T> intern(std::unique_ptr<T[]> table, const size_t size) {
+        static LutStore store;
+
+        const size_t bytes = size * sizeof(T);
+        const uint64_t hash = getHash(table.get(), bytes);
+
+        std::lock_guard<std::mutex> lock{ store.mutex };
+
+        const auto range = store.tables.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            std::shared_ptr<const T> stored = it->second.table.lock();
+            if (stored && it->second.size == size && !std::memcmp(stored.get(), table.get(), bytes))
+                return stored;
+        }
+
+        // expired entries are dropped whenever the store has doubled since the last sweep
+        if (store.tables.size() >= store.sweepAt) {
+            for (auto it = store.tables.begin(); it != store.tables.end();)
+                it = it->second.table.expired() ? store.tables.erase(it) : std::next(it);
+            store.sweepAt = std::max<size_t>(store.tables.size() * 2, 64);
+        }
+
+        std::shared_ptr<const T> stored{ table.release(), std::default_delete<T[]>{} };
+        store.tables.emplace(hash, Entry{ stored, size });
+        return stored;
+    }
+
+private:
+    struct Entry {
+        std::weak_ptr<const T> table;
+        size_t size;
+    };
+
+    // FNV-1a on whole words, since collisions only cost a comparison
+    static uint64_t getHash(const void * data, const size_t bytes) noexcept {
+        const unsigned char * p = static_cast<const unsigned char *>(data);
+        uint64_t hash = 14695981039346656037u ^ bytes;
+        size_t i = 0;
+
+        for (; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, p + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211u;
+        }
+        for (; i < bytes; i++)
+            hash = (hash ^ p[i]) * 1099511628211u;
+
+        return hash;
+    }
+
+    std::unordered_multimap<uint64_t, Entry> tables;
+    size_t sweepAt = 64;
+    std::mutex mutex;
+};
@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(const unsigned numThreads) : stop(false), busy(0) {
+    for (unsigned i = 0; i < numThreads; i++)
+        workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        stop = true;
+    }
+
+    wake.notify_all();
+
+    for (auto & thread : workers)
+        thread.join();
+}
+
+void ThreadPool::run(Job * job, const bool helper) noexcept {
+    const int limit = static_cast<int>(workers.size()) + 1;
+
+    // callers cannot be turned away, so helpers make room for them between bands and leave the rest to the caller
+    for (int i; (!helper || busy <= limit) && (i = job->next++) < job->count;)
+        (*job->task)(i);
+}
+
+void ThreadPool::worker() {
+    std::unique_lock<std::mutex> lock{ mutex };
+
+    while (true) {
+        wake.wait(lock, [this] { return stop || (!queue.empty() && busy <= static_cast<int>(workers.size())); });
+        if (stop)
+            return;
+
+        Job * job = queue.front();
+        if (++job->helpers >= job->maxHelpers)
+            queue.pop_front();
+        busy++;
+
+        {
+            std::lock_guard<std::mutex> jobLock{ job->mutex };
+            job->active++;
+        }
+
+        lock.unlock();
+        run(job, true);
+
+        {
+            std::lock_guard<std::mutex> jobLock{ job->mutex };
+            if (--job->active == 0)
+                job->done.notify_all();
+        }
+
+        lock.lock();
+        busy--;
+
+        // nothing left to hand out, so do not let other helpers pick the job up
+        auto it = std::find(queue.begin(), queue.end(), job);
+        if (it != queue.end() && job->next >= job->count)
+            queue.erase(it);
+    }
+}
+
+void ThreadPool::parallelFor(const int count, const int maxHelpers, const std::function<void(int)> & task) {
+    const int helpers = std::min({ maxHelpers, count - 1, static_cast<int>(workers.size()) });
+
+    if (helpers <= 0) {
+        for (int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    Job job;
+    job.task = &task;
+    job.count = count;
+    job.maxHelpers = helpers;
+    job.helpers = 0;
+    job.next = 0;
+    job.active = 0;
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        queue.push_back(&job);
+        busy++;
+    }
+
+    for (int i = 0; i < helpers; i++)
+        wake.notify_one();
+
+    run(&job, false);
+
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        auto it = std::find(queue.begin(), queue.end(), &job);
+        if (it != queue.end())
+            queue.erase(it);
+        busy--;
+    }
+
+    // the thread that left may let an idle helper join another frame
+    wake.notify_one();
+
+    // helpers that joined before the job left the queue may still be finishing their last band
+    std::unique_lock<std::mutex> jobLock{ job.mutex };
+    job.done.wait(jobLock, [&job] { return job.active == 0; });
+}
+
+std::shared_ptr<ThreadPool> ThreadPool::acquire() {
+    static std::mutex poolMutex;
+    static std::weak_ptr<ThreadPool> shared;
+
+    std::lock_guard<std::mutex> lock{ poolMutex };
+
+    std::shared_ptr<ThreadPool> pool = shared.lock();
+    if (!pool) {
+        pool = std::make_shared<ThreadPool>(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+        shared = pool;
+    }
+
+    return pool;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Process-wide pool of helper threads for splitting one frame into bands.
+ * The calling thread always works on its own job as well, and helpers only join jobs while they are idle,
+ * so a busy pool never delays a frame. Helpers also stay out while the callers splitting a frame and the helpers
+ * already working for them occupy one thread per logical CPU, and leave after their current band when more callers
+ * come in, so concurrent frames oversubscribe the CPUs by at most the bands being finished.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(const unsigned numThreads);
+    ~ThreadPool();
+
+    /**
+     * Calls task(i) for every i in [0, count), with at most maxHelpers pool threads helping the caller.
+     * Tasks are handed out one at a time from a shared counter, so faster threads simply take more of them.
+     */
+    void parallelFor(const int count, const int maxHelpers, const std::function<void(int)> & task);
+
+    unsigned size() const noexcept { return static_cast<unsigned>(workers.size()); }
+
+    /**
+     * Returns the shared pool, creating it with one thread less than the number of logical CPUs on first use.
+     */
+    static std::shared_ptr<ThreadPool> acquire();
+
+private:
+    struct Job {
+        const std::function<void(int)> * task;
+        int count;
+        int maxHelpers;
+        int helpers;
+        std::atomic<int> next;
+        int active;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    void run(Job * job, const bool helper) noexcept;
+    void worker();
+
+    std::vector<std::thread> workers;
+    std::deque<Job *> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop;
+
+    // callers inside parallelFor and the helpers working for them, which may not exceed the pool size plus one
+    std::atomic<int> busy;
+};
@@ -0,0 +1,294 @@
+/**
+ * Measures the throughput of the kernels on synthetic frames and the time it takes to compile and blend curves, without a
+ * source filter or VapourSynth in the way, and prints the results as JSON. Frames are processed on a single thread by the
+ * kernels that the filter would pick for each dispatch target, at every bit depth, in 4:2:0, 4:4:4 and RGB up to 8K.
+ * Arguments restrict the frames to the given resolutions, e.g. "1080p 4k". The kernels and the code that builds their
+ * tables are internal to Curve.cpp, so it is compiled into the benchmark as a whole.
+ */
+
+#include "../Curve/Curve.cpp"
+
+#include <functional>
+
+struct Layout {
+    const char * name;
+    int colorFamily;
+    int subSampling;
+};
+
+struct Resolution {
+    const char * name;
+    int width;
+    int height;
+};
+
+static const Layout layouts[] = { { "420", cmYUV, 1 }, { "444", cmYUV, 0 }, { "rgb", cmRGB, 0 } };
+static const Resolution resolutions[] = { { "1080p", 1920, 1080 }, { "4k", 3840, 2160 }, { "8k", 7680, 4320 } };
+static const char * const levelNames[] = { "c", "avx2", "avx512", "avx512vbmi" };
+
+// preset 4 on the planes instead of the master curve, so that every form of the LUT applies to it
+static const std::vector<double> contrast = { 0,0, 0.149,0.066, 0.831,0.905, 0.905,0.98, 1,1 };
+
+/**
+ * Runs a task until at least minimum seconds have passed and it ran at least three times, and returns its median time
+ * in seconds.
+ */
+static double getMedianTime(const std::function<void()> & task, const double minimum) {
+    std::vector<double> times;
+    double total = 0.0;
+
+    while (times.size() < 3 || (total < minimum && times.size() < 1000)) {
+        const auto start = std::chrono::steady_clock::now();
+        task();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        total += times.back();
+    }
+
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+static VSFormat getFormat(const Layout & layout, const int sampleType, const int bits) {
+    VSFormat format = {};
+    format.id = layout.colorFamily + sampleType * 100000 + bits * 100 + layout.subSampling;
+    format.colorFamily = layout.colorFamily;
+    format.sampleType = sampleType;
+    format.bitsPerSample = bits;
+    format.bytesPerSample = bits <= 8 ? 1 : bits <= 16 ? 2 : 4;
+    format.subSamplingW = layout.subSampling;
+    format.subSamplingH = layout.subSampling;
+    format.numPlanes = 3;
+    return format;
+}
+
+static Settings getSettings(const VSFormat * format, const int width, const int height, const int level, const int stream, const int compact, const int engine) {
+    Settings s = {};
+    s.in = format;
+    s.out = format;
+    s.width = width;
+    s.height = height;
+    s.level = level;
+    s.stream = stream;
+    s.compact = compact;
+    s.engine = engine;
+
+    for (int plane = 0; plane < 3; plane++)
+        s.listed[plane] = s.process[plane] = true;
+
+    return s;
+}
+
+static Stage getContrastStage() {
+    Stage stage = {};
+    for (int plane = 0; plane < 3; plane++)
+        stage.curve[plane] = contrast;
+    return stage;
+}
+
+/**
+ * Planes with rows aligned to 64 bytes like those of VapourSynth, filled with random samples in the range of the format.
+ */
+struct Frame {
+    Frame(const VSFormat * format, const int frameWidth, const int frameHeight) {
+        std::minstd_rand rng;
+
+        for (int plane = 0; plane < 3; plane++) {
+            width[plane] = plane ? frameWidth >> format->subSamplingW : frameWidth;
+            height[plane] = plane ? frameHeight >> format->subSamplingH : frameHeight;
+            stride[plane] = (width[plane] * format->bytesPerSample + 63) & ~63;
+            storage[plane] = std::make_unique<uint8_t[]>(static_cast<size_t>(stride[plane]) * height[plane] + 64);
+            data[plane] = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(storage[plane].get()) + 63) & ~static_cast<uintptr_t>(63));
+
+            for (int y = 0; y < height[plane]; y++) {
+                uint8_t * row = data[plane] + static_cast<ptrdiff_t>(y) * stride[plane];
+                for (int x = 0; x < width[plane]; x++) {
+                    if (format->sampleType == stInteger && format->bytesPerSample == 1)
+                        row[x] = static_cast<uint8_t>(rng());
+                    else if (format->sampleType == stInteger)
+                        reinterpret_cast<uint16_t *>(row)[x] = static_cast<uint16_t>(rng() & ((1 << format->bitsPerSample) - 1));
+                    else if (format->bytesPerSample == 2)
+                        reinterpret_cast<uint16_t *>(row)[x] = floatToHalf((rng() & 0xFFFF) / 65535.0f);
+                    else
+                        reinterpret_cast<float *>(row)[x] = (rng() & 0xFFFF) / 65535.0f;
+                }
+            }
+        }
+    }
+
+    std::unique_ptr<uint8_t[]> storage[3];
+    uint8_t * data[3];
+    int width[3];
+    int height[3];
+    int stride[3];
+};
+
+static const char * getForm(const Grade & grade) {
+    if (grade.cubic[0])
+        return "cubic";
+    if (grade.compact[0])
+        return "compact";
+    if (grade.lut[0] == &grade.floatCurve[0])
+        return "spline";
+    return "lookup";
+}
+
+static bool first = true;
+
+static void benchmarkFrames(const std::vector<const Resolution *> & selected, const int simdLevel) {
+    struct Depth {
+        int sampleType;
+        int bits;
+    };
+
+    std::vector<Depth> depths;
+    for (int bits = 8; bits <= 16; bits++)
+        depths.push_back({ stInteger, bits });
+    depths.push_back({ stFloat, 16 });
+    depths.push_back({ stFloat, 32 });
+
+    for (const Resolution * resolution : selected) {
+        for (const Layout & layout : layouts) {
+            for (const Depth & depth : depths) {
+                const VSFormat format = getFormat(layout, depth.sampleType, depth.bits);
+                const bool isFloat = depth.sampleType == stFloat;
+                const Frame src{ &format, resolution->width, resolution->height };
+                Frame dst{ &format, resolution->width, resolution->height };
+
+                for (int level = 0; level <= simdLevel; level++) {
+                    // avx512vbmi only has a kernel of its own for 8-bit samples
+                    if (level == 3 && (isFloat || depth.bits > 8))
+                        continue;
+
+                    // the C kernels have no stream variant, and direct evaluation and the compact LUT need SIMD
+                    const int numStreams = level ? 2 : 1;
+                    std::vector<std::pair<int, int>> forms = { { 0, 0 } };
+                    if (level && !isFloat && depth.bits >= 9)
+                        forms.push_back({ 0, 1 });
+                    if (level && !isFloat && depth.bits >= 14)
+                        forms.push_back({ 1, 0 });
+
+                    for (int stream = 0; stream < numStreams; stream++) {
+                        for (const auto & form : forms) {
+                            const Settings s = getSettings(&format, resolution->width, resolution->height, level, stream, form.first, form.second);
+                            const std::shared_ptr<const Grade> grade = compileGrade(s, { getContrastStage() }, s.compact);
+
+                            // a form whose tables the curve does not fit falls back to the lookup, which is measured already
+                            const char * name = getForm(*grade);
+                            if ((form.first && strcmp(name, "compact")) || (form.second && strcmp(name, "cubic")))
+                                continue;
+
+                            const double seconds = getMedianTime([&] {
+                                applyGrade(*grade, 3, src.data, dst.data, src.width, src.height, src.stride, dst.stride,
+                                           format.bytesPerSample, format.bytesPerSample, 1, nullptr);
+                            }, 0.1);
+
+                            std::printf("%s\n    { \"target\": \"%s\", \"layout\": \"%s\", \"resolution\": \"%s\", \"width\": %d, \"height\": %d, "
+                                        "\"sample_type\": \"%s\", \"bits\": %d, \"form\": \"%s\", \"stream\": %d, \"ms_per_frame\": %.4f, \"mpix_per_s\": %.1f }",
+                                        first ? "" : ",", levelNames[level], layout.name, resolution->name, resolution->width, resolution->height,
+                                        isFloat ? "float" : "integer", depth.bits, name, stream, seconds * 1000.0,
+                                        static_cast<double>(resolution->width) * resolution->height / seconds / 1000000.0);
+                            std::fflush(stdout);
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Times compileGrade on a few curves, with the compact LUT disabled and with compact=-1, and interpolate alone over the LUT
+ * of each curve of the stage. The first compilation with compact=-1 is reported on its own, since the kernels are only
+ * timed against each other by the first filter of each depth in a process.
+ */
+static void benchmarkCreate(const int simdLevel) {
+    std::vector<std::string> curves;
+    for (int preset = 1; preset <= 10; preset++)
+        curves.push_back("preset=" + std::to_string(preset));
+    curves.push_back("r=0,0,0.1,0.05,0.2,0.16,0.3,0.27,0.4,0.39,0.5,0.5,0.6,0.62,0.7,0.73,0.8,0.84,0.9,0.94,1,1 master=0,0.02,1,0.98");
+
+    for (const std::string & curve : curves) {
+        for (const Layout & layout : { layouts[0], layouts[2] }) {
+            for (const int bits : { 8, 10, 16 }) {
+                const VSFormat format = getFormat(layout, stInteger, bits);
+                const Stage stage = parseStage(curve);
+
+                Stage loaded = stage;
+                loadStage(loaded);
+                const int lutSize = 1 << bits;
+                const Levels levels = { 0, lutSize - 1, lutSize - 1 };
+                const Quantizer q = { levels, false, 0.0f };
+                auto graph = std::make_unique<uint16_t[]>(lutSize);
+
+                const double interpolation = getMedianTime([&] {
+                    for (const std::vector<double> & points : loaded.curve) {
+                        if (!points.empty())
+                            interpolate(getSegments(points, levels), lutSize, levels, [&](const int i, const double y) { quantize(graph[i], y, q); });
+                    }
+                }, 0.05);
+
+                const Settings flat = getSettings(&format, 1920, 1080, simdLevel, 0, 0, 0);
+                const double compilation = getMedianTime([&] { compileGrade(flat, { stage }, 0); }, 0.05);
+
+                const Settings tuned = getSettings(&format, 1920, 1080, simdLevel, 0, -1, 0);
+                const auto start = std::chrono::steady_clock::now();
+                compileGrade(tuned, { stage }, -1);
+                const double firstTuning = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                const double tuning = getMedianTime([&] { compileGrade(tuned, { stage }, -1); }, 0.05);
+
+                std::printf("%s\n    { \"curve\": \"%s\", \"layout\": \"%s\", \"bits\": %d, \"interpolate_us\": %.2f, \"compile_us\": %.2f, "
+                            "\"compile_tuned_us\": %.2f, \"compile_tuned_first_us\": %.2f }",
+                            first ? "" : ",", curve.c_str(), layout.name, bits, interpolation * 1e6, compilation * 1e6, tuning * 1e6, firstTuning * 1e6);
+                std::fflush(stdout);
+                first = false;
+            }
+        }
+    }
+}
+
+/**
+ * Times blendGrades between two looks, which is what a frame between keyframes costs before its blend is cached.
+ */
+static void benchmarkBlend(const int simdLevel) {
+    for (const Layout & layout : { layouts[0], layouts[2] }) {
+        for (const int bits : { 8, 10, 16 }) {
+            const VSFormat format = getFormat(layout, stInteger, bits);
+            const Settings s = getSettings(&format, 1920, 1080, simdLevel, 0, 0, 0);
+            const std::shared_ptr<const Grade> from = compileGrade(s, { parseStage("preset=0") }, 0, true);
+            const std::shared_ptr<const Grade> to = compileGrade(s, { getContrastStage() }, 0, true);
+
+            const double blending = getMedianTime([&] { blendGrades(*from, *to, 0.37f); }, 0.05);
+
+            std::printf("%s\n    { \"layout\": \"%s\", \"bits\": %d, \"blend_us\": %.2f }",
+                        first ? "" : ",", layout.name, bits, blending * 1e6);
+            std::fflush(stdout);
+            first = false;
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+#ifdef CURVE_X86
+    const int simdLevel = getSimdLevel();
+#else
+    const int simdLevel = 0;
+#endif
+
+    std::vector<const Resolution *> selected;
+    for (const Resolution & resolution : resolutions) {
+        if (argc < 2 || std::any_of(argv + 1, argv + argc, [&](const char * name) { return !strcmp(name, resolution.name); }))
+            selected.push_back(&resolution);
+    }
+
+    std::printf("{\n  \"simd\": \"%s\",\n  \"frames\": [", levelNames[simdLevel]);
+    benchmarkFrames(selected, simdLevel);
+    std::printf("\n  ],\n  \"create\": [");
+    first = true;
+    benchmarkCreate(simdLevel);
+    std::printf("\n  ],\n  \"blend\": [");
+    first = true;
+    benchmarkBlend(simdLevel);
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
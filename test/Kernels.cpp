@@ -0,0 +1,494 @@
+/**
+ * Checks every kernel against the scalar code it replaces, bit for bit, over random LUTs and curves at every bit depth,
+ * widths that are not multiples of the vector size, padded strides, unaligned rows and skipped planes. Kernels of an ISA
+ * that the CPU lacks are skipped. The kernels and the code that builds their tables are internal to Curve.cpp, so it is
+ * compiled into the test as a whole.
+ */
+
+#include "../Curve/Curve.cpp"
+
+#include <initializer_list>
+#include <limits>
+
+struct Kernel {
+    const char * name;
+    int level;
+    filter_t filter;
+};
+
+static const char * const levelNames[] = { "c", "avx2", "avx512", "avx512vbmi" };
+
+static int simdLevel;
+static int numChecks;
+static int numMismatches;
+
+// a fixed seed, so that a mismatch shows up again on the next run
+static std::mt19937 rng{ 20131104 };
+
+static int getRandom(const int low, const int high) {
+    return std::uniform_int_distribution<int>{ low, high }(rng);
+}
+
+static double getRandom(const double low, const double high) {
+    return std::uniform_real_distribution<double>{ low, high }(rng);
+}
+
+/**
+ * Plane with padded rows, whose first sample lies offset samples past a 64-byte boundary, so that the stream kernels go
+ * through their scalar head. A guard follows the last row, and comparing the whole buffer also catches writes to the
+ * padding or past the plane.
+ */
+template<typename T>
+struct Plane {
+    static constexpr int guard = 64;
+
+    Plane(const int width, const int height, const ptrdiff_t stride, const int offset) :
+        width(width), height(height), stride(stride), size(offset + stride * height + guard), storage((size + 64 / sizeof(T)) * sizeof(T), 0xA5) {
+        base = reinterpret_cast<T *>((reinterpret_cast<uintptr_t>(storage.data()) + 63) & ~static_cast<uintptr_t>(63));
+        data = base + offset;
+    }
+
+    int width;
+    int height;
+    ptrdiff_t stride;
+    ptrdiff_t size;
+    std::vector<uint8_t> storage;
+    T * base;
+    T * data;
+};
+
+template<typename T>
+static bool isEqual(const Plane<T> & a, const Plane<T> & b, ptrdiff_t & mismatch) {
+    for (ptrdiff_t i = 0; i < a.size; i++) {
+        if (std::memcmp(a.base + i, b.base + i, sizeof(T))) {
+            mismatch = i - (a.data - a.base);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report(const std::string & name, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const ptrdiff_t mismatch) {
+    if (++numMismatches <= 20)
+        std::fprintf(stderr, "MISMATCH %s: width %d height %d strides %td/%td, first at sample %td (row %td column %td)\n",
+                     name.c_str(), width, height, srcStride, dstStride, mismatch, mismatch / dstStride, mismatch % dstStride);
+}
+
+/**
+ * Runs the kernels and the reference over a range of plane sizes, filling the source, padding included, by generate.
+ */
+template<typename T, typename U, typename F>
+static void checkKernels(const std::string & name, const std::initializer_list<Kernel> kernels, const void * lut, const filter_t reference,
+                         const void * referenceLut, F && generate) {
+    static const int widths[] = { 1, 2, 7, 8, 15, 16, 17, 31, 33, 63, 64, 65, 100, 127, 129, 257 };
+    static const int heights[] = { 1, 2, 9 };
+
+    for (const int width : widths) {
+        for (const int height : heights) {
+            const ptrdiff_t srcStride = width + getRandom(0, 40);
+            const ptrdiff_t dstStride = width + getRandom(0, 40);
+            const int dstOffset = getRandom(0, 63 / static_cast<int>(sizeof(U)));
+
+            Plane<T> src{ width, height, srcStride, getRandom(0, 63 / static_cast<int>(sizeof(T))) };
+            for (ptrdiff_t i = 0; i < src.size; i++)
+                src.base[i] = generate();
+
+            Plane<U> expected{ width, height, dstStride, dstOffset };
+            reference(src.data, expected.data, width, height, srcStride, dstStride, referenceLut);
+
+            for (const Kernel & kernel : kernels) {
+                if (kernel.level > simdLevel)
+                    continue;
+
+                Plane<U> actual{ width, height, dstStride, dstOffset };
+                kernel.filter(src.data, actual.data, width, height, srcStride, dstStride, lut);
+
+                ptrdiff_t mismatch;
+                numChecks++;
+                if (!isEqual(expected, actual, mismatch))
+                    report(name + " " + kernel.name, width, height, srcStride, dstStride, mismatch);
+            }
+        }
+    }
+}
+
+/**
+ * Random key points of a curve, which checkPoints accepts at the given levels.
+ */
+static std::vector<double> getRandomPoints(const int maxPoints, const Levels & levels) {
+    for (;;) {
+        const int n = getRandom(2, maxPoints);
+        std::vector<double> x(n);
+        for (double & value : x)
+            value = getRandom(0.0, 1.0);
+        std::sort(x.begin(), x.end());
+
+        std::vector<double> points;
+        for (const double value : x) {
+            points.push_back(value);
+            points.push_back(getRandom(0.0, 1.0));
+        }
+
+        try {
+            checkPoints(points, levels);
+            return points;
+        } catch (const std::string &) {
+        }
+    }
+}
+
+static std::unique_ptr<uint16_t[]> getRandomGraph(const int lutSize, const int peak) {
+    auto graph = std::make_unique<uint16_t[]>(lutSize + 1);
+    for (int i = 0; i <= lutSize; i++)
+        graph[i] = static_cast<uint16_t>(getRandom(0, peak));
+    return graph;
+}
+
+static std::unique_ptr<uint16_t[]> getCurveGraph(const std::vector<segment> & segments, const int lutSize, const Levels & levels) {
+    auto graph = std::make_unique<uint16_t[]>(lutSize + 1);
+    fillGraph(graph.get(), segments, nullptr, lutSize, levels, Quantizer{ levels, false, 0.0f });
+    return graph;
+}
+
+/**
+ * The SIMD kernels of float clips evaluate the splines with FMA, which the C kernel does not, so they are checked against
+ * the same loop with FMA.
+ */
+template<typename T, typename U>
+static void filter_float_fma(const void * _srcp, void * _dstp, const int width, const int height, const ptrdiff_t srcStride, const ptrdiff_t dstStride, const void * _curve) noexcept {
+    const T * srcp = static_cast<const T *>(_srcp);
+    U * VS_RESTRICT dstp = static_cast<U *>(_dstp);
+    const FloatCurve * curve = static_cast<const FloatCurve *>(_curve);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++)
+            fromFloat(dstp + x, evaluateFloat<true>(curve, toFloat(srcp[x])));
+
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+template<typename T>
+static void checkLookup(const int depth) {
+    const int lutSize = 1 << depth;
+    const auto graph = getRandomGraph(lutSize, lutSize - 1);
+    const std::string name = "lookup " + std::to_string(depth) + "-bit";
+    const auto generate = [=] { return static_cast<T>(rng() & (lutSize - 1)); };
+
+    if (std::is_same<T, uint8_t>::value)
+        checkKernels<T, T>(name, {
+            { "avx2", 1, filter_avx2<uint8_t, false> },
+            { "avx2 stream", 1, filter_avx2<uint8_t, true> },
+            { "avx512", 2, filter_avx512<uint8_t, false> },
+            { "avx512 stream", 2, filter_avx512<uint8_t, true> },
+            { "avx512vbmi", 3, filter_avx512vbmi<uint8_t, false> },
+            { "avx512vbmi stream", 3, filter_avx512vbmi<uint8_t, true> },
+        }, graph.get(), filter_c<T>, graph.get(), generate);
+    else
+        checkKernels<T, T>(name, {
+            { "avx2", 1, filter_avx2<uint16_t, false> },
+            { "avx2 stream", 1, filter_avx2<uint16_t, true> },
+            { "avx512", 2, filter_avx512<uint16_t, false> },
+            { "avx512 stream", 2, filter_avx512<uint16_t, true> },
+        }, graph.get(), filter_c<T>, graph.get(), generate);
+}
+
+/**
+ * Straight lines clamped at random points, as getAffineMap finds them in the LUTs, and the inversion. The slope of a map
+ * has a limited precision, so getAffineMap may reject a line and leave it to the lookup, but not every one of them.
+ */
+template<typename T>
+static void checkArithmetic(const int depth) {
+    const int lutSize = 1 << depth;
+    const int scale = lutSize - 1;
+    const auto generate = [=] { return static_cast<T>(rng() & scale); };
+    int numMaps = 0;
+
+    for (int i = 0; i < 16; i++) {
+        const double slope = getRandom(-3.0, 3.0);
+        const double offset = getRandom(-0.5, 1.5) * scale;
+        auto graph = std::make_unique<uint16_t[]>(lutSize + 1);
+        for (int x = 0; x < lutSize; x++)
+            graph[x] = static_cast<uint16_t>(std::min(std::max(std::floor(slope * x + offset + 0.5), 0.0), static_cast<double>(scale)));
+
+        AffineMap map;
+        if (!getAffineMap(graph.get(), lutSize, map))
+            continue;
+
+        numMaps++;
+        checkKernels<T, T>("affine " + std::to_string(depth) + "-bit", {
+            { "c", 0, filter_affine_c<T> },
+            { "avx2", 1, filter_affine_avx2<T, false> },
+            { "avx2 stream", 1, filter_affine_avx2<T, true> },
+        }, &map, filter_c<T>, graph.get(), generate);
+    }
+
+    if (!numMaps) {
+        numMismatches++;
+        std::fprintf(stderr, "MISMATCH affine %d-bit: getAffineMap rejected every line\n", depth);
+    }
+
+    auto graph = std::make_unique<uint16_t[]>(lutSize + 1);
+    for (int x = 0; x < lutSize; x++)
+        graph[x] = static_cast<uint16_t>(scale - x);
+
+    const AffineMap map = { 0, scale, -1, scale, 0 };
+    checkKernels<T, T>("invert " + std::to_string(depth) + "-bit", {
+        { "c", 0, filter_invert_c<T> },
+        { "avx2", 1, filter_invert_avx2<T, false> },
+        { "avx2 stream", 1, filter_invert_avx2<T, true> },
+    }, &map, filter_c<T>, graph.get(), generate);
+}
+
+/**
+ * The compact form only holds smooth curves, so the LUTs are filled from random key points, skipping those it rejects.
+ */
+static void checkCompact(const int depth) {
+    const int lutSize = 1 << depth;
+    const Levels levels = { 0, lutSize - 1, lutSize - 1 };
+    const auto generate = [=] { return static_cast<uint16_t>(rng() & (lutSize - 1)); };
+
+    for (int i = 0; i < 8; i++) {
+        const auto graph = getCurveGraph(getSegments(getRandomPoints(6, levels), levels), lutSize, levels);
+        const auto lut = compactGraph(graph.get(), lutSize);
+        if (!lut)
+            continue;
+
+        checkKernels<uint16_t, uint16_t>("compact " + std::to_string(depth) + "-bit", {
+            { "avx2", 1, filter_compact_avx2<false> },
+            { "avx2 stream", 1, filter_compact_avx2<true> },
+            { "avx512", 2, filter_compact_avx512<false> },
+            { "avx512 stream", 2, filter_compact_avx512<true> },
+        }, lut.get(), filter_c<uint16_t>, graph.get(), generate);
+    }
+}
+
+/**
+ * Direct evaluation is checked against the LUT of the same spline, which the scalar code fills with the same FMA.
+ */
+static void checkCubic(const int depth) {
+    const int lutSize = 1 << depth;
+    const int scale = lutSize - 1;
+    const Levels levels = { 0, scale, scale };
+    const auto generate = [=] { return static_cast<uint16_t>(rng() & scale); };
+
+    for (int i = 0; i < 8; i++) {
+        const auto spline = getCubicSpline(i ? getSegments(getRandomPoints(CubicSpline::maxSegments, levels), levels) : std::vector<segment>{}, scale);
+        auto graph = std::make_unique<uint16_t[]>(lutSize + 1);
+        for (int x = 0; x < lutSize; x++)
+            graph[x] = evaluateCubic(spline.get(), x);
+
+        checkKernels<uint16_t, uint16_t>("cubic " + std::to_string(depth) + "-bit", {
+            { "avx2", 1, filter_cubic_avx2<false> },
+            { "avx2 stream", 1, filter_cubic_avx2<true> },
+            { "avx512", 2, filter_cubic_avx512<false> },
+            { "avx512 stream", 2, filter_cubic_avx512<true> },
+        }, spline.get(), filter_c<uint16_t>, graph.get(), generate);
+    }
+}
+
+template<typename T, typename U>
+static void checkConvert(const int depth, const int outDepth) {
+    using G = typename std::conditional<std::is_same<U, float>::value, float, uint16_t>::type;
+
+    const int lutSize = 1 << depth;
+    auto graph = std::make_unique<G[]>(lutSize + 1);
+    for (int i = 0; i <= lutSize; i++)
+        graph[i] = std::is_same<U, float>::value ? static_cast<G>(getRandom(-0.5, 1.5)) : static_cast<G>(getRandom(0, (1 << outDepth) - 1));
+
+    checkKernels<T, U>("convert " + std::to_string(depth) + "-bit to " + (std::is_same<U, float>::value ? "float" : std::to_string(outDepth) + "-bit"), {
+        { "avx2", 1, filter_convert_avx2<T, U, false> },
+        { "avx2 stream", 1, filter_convert_avx2<T, U, true> },
+    }, graph.get(), filter_c<T, U, G>, graph.get(), [=] { return static_cast<T>(rng() & (lutSize - 1)); });
+}
+
+template<typename T, typename U>
+static void checkDither(const int depth, const int outDepth) {
+    const int lutSize = 1 << depth;
+
+    DitherMap map = {};
+    map.scale = (1 << outDepth) - 1;
+    map.shift = 16 - outDepth;
+    setThresholds(map);
+
+    const auto graph = getRandomGraph(lutSize, map.scale << map.shift);
+    map.graph = graph.get();
+
+    checkKernels<T, U>("ordered dither " + std::to_string(depth) + "-bit to " + std::to_string(outDepth) + "-bit", {
+        { "avx2", 1, filter_dither_avx2<T, U, false> },
+        { "avx2 stream", 1, filter_dither_avx2<T, U, true> },
+    }, &map, filter_dither_c<T, U, ditherOrdered>, &map, [=] { return static_cast<T>(rng() & (lutSize - 1)); });
+}
+
+/**
+ * Splines of more than eight segments are gathered instead of permuted from registers, so both are covered. Samples spread
+ * beyond [0;1], and some are NaN.
+ */
+template<typename T, typename U>
+static void checkFloat() {
+    const Levels levels = { 0, 65535, 65535 };
+
+    for (int i = 0; i < 16; i++) {
+        FloatCurve curve = {};
+        curve.spline[0] = getFloatSpline(getSegments(getRandomPoints(i < 8 ? 8 : 17, levels), levels), 65535);
+        curve.spline[1] = getFloatSpline(i & 1 ? getSegments(getRandomPoints(4, levels), levels) : std::vector<segment>{}, 65535);
+        curve.offset = i & 2 ? 0.5f : 0.0f;
+
+        const auto generate = [&] {
+            float x = static_cast<float>(getRandom(-0.25, 1.25)) - curve.offset;
+            if (!getRandom(0, 63))
+                x = std::numeric_limits<float>::quiet_NaN();
+
+            T sample;
+            fromFloat(&sample, x);
+            return sample;
+        };
+
+        checkKernels<T, U>(std::string{ "float " } + (std::is_same<T, float>::value ? "single" : "half") + " to " + (std::is_same<U, float>::value ? "single" : "half"), {
+            { "avx2", 1, filter_float_avx2<T, U, false> },
+            { "avx2 stream", 1, filter_float_avx2<T, U, true> },
+            { "avx512", 2, filter_float_avx512<T, U, false> },
+            { "avx512 stream", 2, filter_float_avx512<T, U, true> },
+        }, &curve, filter_float_fma<T, U>, &curve, generate);
+    }
+}
+
+/**
+ * Runs applyGrade over whole frames, with some planes skipped, fused planes and threaded bands, and checks every plane
+ * against the reference applied to it in one call. Skipped planes must be left alone.
+ */
+template<typename T, typename U>
+static void checkFrame(const int depth, const int level, const int dither, const filter_t filter, const filter_t reference, const bool subsampled,
+                       const bool fused, const int threads, ThreadPool * pool) {
+    constexpr int frameWidth = 203;
+    constexpr int frameHeight = 301;
+    const int lutSize = 1 << depth;
+    const int outDepth = sizeof(U) == 1 ? 8 : depth;
+
+    DitherMap maps[3] = {};
+    std::unique_ptr<uint16_t[]> graphs[3];
+    for (int plane = 0; plane < 3; plane++) {
+        maps[plane].scale = (1 << outDepth) - 1;
+        maps[plane].shift = dither != ditherNone ? 16 - outDepth : 0;
+        setThresholds(maps[plane]);
+        graphs[plane] = getRandomGraph(lutSize, maps[plane].scale << maps[plane].shift);
+        maps[plane].graph = graphs[plane].get();
+    }
+
+    for (int mask = 0; mask < 8; mask++) {
+        Grade grade = {};
+        grade.fused = fused;
+        grade.dither = dither;
+
+        std::vector<Plane<T>> src;
+        std::vector<Plane<U>> expected, actual;
+        const uint8_t * srcp[3] = {};
+        uint8_t * dstp[3] = {};
+        int width[3], height[3], srcStride[3], dstStride[3];
+
+        for (int plane = 0; plane < 3; plane++) {
+            width[plane] = subsampled && plane ? (frameWidth + 1) >> 1 : frameWidth;
+            height[plane] = subsampled && plane ? (frameHeight + 1) >> 1 : frameHeight;
+            const int srcPadding = getRandom(0, 40);
+            const int dstPadding = getRandom(0, 40);
+
+            src.emplace_back(width[plane], height[plane], width[plane] + srcPadding, getRandom(0, 7));
+            expected.emplace_back(width[plane], height[plane], width[plane] + dstPadding, 0);
+            actual.emplace_back(width[plane], height[plane], width[plane] + dstPadding, 0);
+        }
+
+        for (int plane = 0; plane < 3; plane++) {
+            for (ptrdiff_t i = 0; i < src[plane].size; i++)
+                src[plane].base[i] = static_cast<T>(rng() & (lutSize - 1));
+
+            grade.process[plane] = !!(mask & (1 << plane));
+            grade.filter[plane] = filter;
+            grade.lut[plane] = dither != ditherNone ? static_cast<const void *>(&maps[plane]) : graphs[plane].get();
+
+            srcp[plane] = reinterpret_cast<const uint8_t *>(src[plane].data);
+            dstp[plane] = reinterpret_cast<uint8_t *>(actual[plane].data);
+            srcStride[plane] = static_cast<int>(src[plane].stride * sizeof(T));
+            dstStride[plane] = static_cast<int>(actual[plane].stride * sizeof(U));
+
+            if (grade.process[plane])
+                reference(src[plane].data, expected[plane].data, width[plane], height[plane], src[plane].stride, expected[plane].stride, grade.lut[plane]);
+        }
+
+        applyGrade(grade, 3, srcp, dstp, width, height, srcStride, dstStride, sizeof(T), sizeof(U), threads, pool);
+
+        for (int plane = 0; plane < 3; plane++) {
+            ptrdiff_t mismatch;
+            numChecks++;
+            if (!isEqual(expected[plane], actual[plane], mismatch))
+                report("frame " + std::to_string(depth) + "-bit " + levelNames[level] + (dither == ditherOrdered ? " ordered dither" : dither == ditherErrorDiffusion ? " error diffusion" : "") +
+                       (subsampled ? " 4:2:0" : " 4:4:4") + (fused ? " fused" : "") + " threads " + std::to_string(threads) + " planes " + std::to_string(mask) +
+                       " plane " + std::to_string(plane), width[plane], height[plane], src[plane].stride, actual[plane].stride, mismatch);
+        }
+    }
+}
+
+template<typename T>
+static void checkFrames(const int depth, ThreadPool * pool) {
+    for (int level = 0; level <= simdLevel; level++) {
+        filter_t lookup = filter_c<T>;
+        filter_t dither = filter_dither_c<T, uint8_t, ditherOrdered>;
+
+        if (level == 3 && sizeof(T) == 1)
+            lookup = filter_avx512vbmi<uint8_t, false>;
+        else if (level >= 2)
+            lookup = filter_avx512<T, false>;
+        else if (level == 1)
+            lookup = filter_avx2<T, false>;
+
+        if (level >= 1)
+            dither = filter_dither_avx2<T, uint8_t, false>;
+
+        for (const int threads : { 1, 3 }) {
+            for (const bool subsampled : { false, true }) {
+                const bool fused = !subsampled;
+                checkFrame<T, T>(depth, level, ditherNone, lookup, filter_c<T>, subsampled, fused, threads, pool);
+                checkFrame<T, uint8_t>(depth, level, ditherOrdered, dither, filter_dither_c<T, uint8_t, ditherOrdered>, subsampled, fused, threads, pool);
+                if (level == 0)
+                    checkFrame<T, uint8_t>(depth, level, ditherErrorDiffusion, filter_dither_c<T, uint8_t, ditherErrorDiffusion>,
+                                           filter_dither_c<T, uint8_t, ditherErrorDiffusion>, subsampled, fused, threads, pool);
+            }
+        }
+    }
+}
+
+int main() {
+    simdLevel = getSimdLevel();
+    for (int level = simdLevel + 1; level <= 3; level++)
+        std::printf("%s is not supported by this CPU, its kernels are skipped\n", levelNames[level]);
+
+    std::shared_ptr<ThreadPool> pool = ThreadPool::acquire();
+
+    checkLookup<uint8_t>(8);
+    checkArithmetic<uint8_t>(8);
+    checkConvert<uint8_t, uint16_t>(8, 16);
+    checkConvert<uint8_t, float>(8, 0);
+    checkDither<uint8_t, uint8_t>(8, 8);
+    checkDither<uint8_t, uint16_t>(8, 10);
+    checkFrames<uint8_t>(8, pool.get());
+
+    for (int depth = 9; depth <= 16; depth++) {
+        checkLookup<uint16_t>(depth);
+        checkArithmetic<uint16_t>(depth);
+        checkCompact(depth);
+        checkCubic(depth);
+        checkConvert<uint16_t, uint8_t>(depth, 8);
+        checkConvert<uint16_t, float>(depth, 0);
+        checkDither<uint16_t, uint8_t>(depth, 8);
+        checkDither<uint16_t, uint16_t>(depth, std::max(depth - 1, 9));
+        checkFrames<uint16_t>(depth, pool.get());
+    }
+
+    checkFloat<float, float>();
+    checkFloat<float, uint16_t>();
+    checkFloat<uint16_t, float>();
+    checkFloat<uint16_t, uint16_t>();
+
+    std::printf("%d checks, %d mismatches\n", numChecks, numMismatches);
+    return numMismatches ? 1 : 0;
+}